@@ -0,0 +1,705 @@
+/*
+ * Copyright (C) 2026 libva-v4l2-request contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "av1.h"
+#include "context.h"
+#include "request.h"
+#include "surface.h"
+
+#include <string.h>
+
+#include <linux/videodev2.h>
+#include <av1-ctrls.h>
+
+#include "utils.h"
+#include "v4l2.h"
+
+#if VA_CHECK_VERSION(1, 8, 0)
+
+#define AV1_RESTORATION_TILESIZE_MAX	256
+#define AV1_WARPEDMODEL_PREC_BITS	16
+
+/*
+ * Slice parameters are rendered ahead of the slice data they describe, so
+ * tile offsets are rebased onto where that data lands in the source buffer
+ * and several tile groups can share it without any extra copy.
+ */
+VAStatus av1_store_slice_params(struct object_surface *surface_object,
+				VASliceParameterBufferAV1 *slices,
+				unsigned int count)
+{
+	struct av1_tile *tile;
+	unsigned int i;
+
+	if (surface_object->params->av1.tiles_count + count > AV1_MAX_TILES)
+		return VA_STATUS_ERROR_MAX_NUM_EXCEEDED;
+
+	for (i = 0; i < count; i++) {
+		tile = &surface_object->params->av1.tiles[
+			surface_object->params->av1.tiles_count++];
+
+		tile->offset = surface_object->slices_size +
+			       slices[i].slice_data_offset;
+		tile->size = slices[i].slice_data_size;
+		tile->row = slices[i].tile_row;
+		tile->column = slices[i].tile_column;
+	}
+
+	return VA_STATUS_SUCCESS;
+}
+
+static void av1_update_ref_map(struct request_data *driver_data,
+			       struct av1_ref_map *ref_map,
+			       VADecPictureParameterBufferAV1 *picture)
+{
+	struct object_surface *surface_object;
+	VASurfaceID surface_id;
+	unsigned int i;
+
+	for (i = 0; i < AV1_NUM_REF_FRAMES; i++) {
+		surface_id = picture->ref_frame_map[i];
+		if (ref_map->surfaces_ids[i] == surface_id)
+			continue;
+
+		ref_map->surfaces_ids[i] = surface_id;
+		ref_map->order_hints[i] = 0;
+		ref_map->timestamps[i] = 0;
+
+		/*
+		 * A surface cannot be decoded into while it sits in a slot, so
+		 * its order hint is still that of the referenced frame.
+		 */
+		surface_object = SURFACE(driver_data, surface_id);
+		if (surface_object == NULL)
+			continue;
+
+		ref_map->order_hints[i] = surface_object->order_hint;
+		ref_map->timestamps[i] =
+			v4l2_timeval_to_ns(&surface_object->timestamp);
+	}
+}
+
+static int av1_relative_dist(VADecPictureParameterBufferAV1 *picture,
+			     unsigned int a, unsigned int b)
+{
+	unsigned int bits = picture->order_hint_bits_minus_1 + 1;
+	int diff, m;
+
+	if (!picture->seq_info_fields.fields.enable_order_hint)
+		return 0;
+
+	diff = a - b;
+	m = 1 << (bits - 1);
+
+	return (diff & (m - 1)) - (diff & m);
+}
+
+/* VA only signals skip_mode_present, the frames are derived as in 7.20. */
+static void av1_fill_skip_mode(VADecPictureParameterBufferAV1 *picture,
+			       struct av1_ref_map *ref_map,
+			       struct v4l2_ctrl_av1_frame *frame)
+{
+	int forward_idx = -1, backward_idx = -1, second_idx = -1;
+	unsigned int forward_hint = 0, backward_hint = 0, second_hint = 0;
+	unsigned int hint;
+	int first, second;
+	int i;
+
+	if (!picture->mode_control_fields.bits.skip_mode_present)
+		return;
+
+	for (i = 0; i < V4L2_AV1_REFS_PER_FRAME; i++) {
+		hint = ref_map->order_hints[picture->ref_frame_idx[i]];
+
+		if (av1_relative_dist(picture, hint, picture->order_hint) < 0) {
+			if (forward_idx < 0 ||
+			    av1_relative_dist(picture, hint, forward_hint) > 0) {
+				forward_idx = i;
+				forward_hint = hint;
+			}
+		} else if (av1_relative_dist(picture, hint,
+					     picture->order_hint) > 0) {
+			if (backward_idx < 0 ||
+			    av1_relative_dist(picture, hint, backward_hint) < 0) {
+				backward_idx = i;
+				backward_hint = hint;
+			}
+		}
+	}
+
+	if (forward_idx < 0)
+		return;
+
+	if (backward_idx >= 0) {
+		second = backward_idx;
+	} else {
+		for (i = 0; i < V4L2_AV1_REFS_PER_FRAME; i++) {
+			hint = ref_map->order_hints[picture->ref_frame_idx[i]];
+
+			if (av1_relative_dist(picture, hint, forward_hint) < 0 &&
+			    (second_idx < 0 ||
+			     av1_relative_dist(picture, hint, second_hint) > 0)) {
+				second_idx = i;
+				second_hint = hint;
+			}
+		}
+
+		if (second_idx < 0)
+			return;
+
+		second = second_idx;
+	}
+
+	first = forward_idx;
+	if (second < first) {
+		first = second;
+		second = forward_idx;
+	}
+
+	frame->skip_mode_frame[0] = V4L2_AV1_REF_LAST_FRAME + first;
+	frame->skip_mode_frame[1] = V4L2_AV1_REF_LAST_FRAME + second;
+	frame->flags |= V4L2_AV1_FRAME_FLAG_SKIP_MODE_ALLOWED |
+			V4L2_AV1_FRAME_FLAG_SKIP_MODE_PRESENT;
+}
+
+static void av1_fill_tile_info(VADecPictureParameterBufferAV1 *picture,
+			       struct v4l2_ctrl_av1_frame *frame)
+{
+	struct v4l2_av1_tile_info *tile_info = &frame->tile_info;
+	unsigned int sb_shift;
+	unsigned int mi_cols, mi_rows;
+	unsigned int start;
+	unsigned int i;
+
+	sb_shift = picture->seq_info_fields.fields.use_128x128_superblock ?
+			   5 : 4;
+	mi_cols = 2 * ((frame->frame_width_minus_1 + 1 + 7) >> 3);
+	mi_rows = 2 * ((frame->frame_height_minus_1 + 1 + 7) >> 3);
+
+	if (picture->pic_info_fields.bits.uniform_tile_spacing_flag)
+		tile_info->flags |=
+			V4L2_AV1_TILE_INFO_FLAG_UNIFORM_TILE_SPACING;
+
+	tile_info->context_update_tile_id = picture->context_update_tile_id;
+	tile_info->tile_cols = picture->tile_cols;
+	tile_info->tile_rows = picture->tile_rows;
+
+	start = 0;
+	for (i = 0; i < picture->tile_cols; i++) {
+		tile_info->width_in_sbs_minus_1[i] =
+			picture->width_in_sbs_minus_1[i];
+		tile_info->mi_col_starts[i] = start;
+		start += (picture->width_in_sbs_minus_1[i] + 1) << sb_shift;
+	}
+	tile_info->mi_col_starts[i] = start < mi_cols ? start : mi_cols;
+
+	start = 0;
+	for (i = 0; i < picture->tile_rows; i++) {
+		tile_info->height_in_sbs_minus_1[i] =
+			picture->height_in_sbs_minus_1[i];
+		tile_info->mi_row_starts[i] = start;
+		start += (picture->height_in_sbs_minus_1[i] + 1) << sb_shift;
+	}
+	tile_info->mi_row_starts[i] = start < mi_rows ? start : mi_rows;
+}
+
+static void av1_fill_segmentation(VADecPictureParameterBufferAV1 *picture,
+				  struct v4l2_ctrl_av1_frame *frame)
+{
+	VASegmentationStructAV1 *seg_info = &picture->seg_info;
+	struct v4l2_av1_segmentation *segmentation = &frame->segmentation;
+	unsigned int i;
+
+	if (seg_info->segment_info_fields.bits.enabled)
+		segmentation->flags |= V4L2_AV1_SEGMENTATION_FLAG_ENABLED;
+	if (seg_info->segment_info_fields.bits.update_map)
+		segmentation->flags |= V4L2_AV1_SEGMENTATION_FLAG_UPDATE_MAP;
+	if (seg_info->segment_info_fields.bits.temporal_update)
+		segmentation->flags |=
+			V4L2_AV1_SEGMENTATION_FLAG_TEMPORAL_UPDATE;
+	if (seg_info->segment_info_fields.bits.update_data)
+		segmentation->flags |= V4L2_AV1_SEGMENTATION_FLAG_UPDATE_DATA;
+
+	memcpy(segmentation->feature_data, seg_info->feature_data,
+	       sizeof(segmentation->feature_data));
+
+	for (i = 0; i < V4L2_AV1_MAX_SEGMENTS; i++) {
+		segmentation->feature_enabled[i] = seg_info->feature_mask[i];
+
+		if (seg_info->feature_mask[i] != 0)
+			segmentation->last_active_seg_id = i;
+
+		/* Reference features are coded before the skip flag. */
+		if (seg_info->feature_mask[i] >>
+		    V4L2_AV1_SEG_LVL_REF_FRAME)
+			segmentation->flags |=
+				V4L2_AV1_SEGMENTATION_FLAG_SEG_ID_PRE_SKIP;
+	}
+}
+
+static void av1_fill_loop_restoration(VADecPictureParameterBufferAV1 *picture,
+				      struct v4l2_ctrl_av1_frame *frame)
+{
+	struct v4l2_av1_loop_restoration *restoration =
+		&frame->loop_restoration;
+	unsigned int i;
+
+	restoration->frame_restoration_type[0] =
+		picture->loop_restoration_fields.bits.yframe_restoration_type;
+	restoration->frame_restoration_type[1] =
+		picture->loop_restoration_fields.bits.cbframe_restoration_type;
+	restoration->frame_restoration_type[2] =
+		picture->loop_restoration_fields.bits.crframe_restoration_type;
+
+	for (i = 0; i < V4L2_AV1_NUM_PLANES_MAX; i++) {
+		if (restoration->frame_restoration_type[i] ==
+		    V4L2_AV1_FRAME_RESTORE_NONE)
+			continue;
+
+		restoration->flags |= V4L2_AV1_LOOP_RESTORATION_FLAG_USES_LR;
+		if (i > 0)
+			restoration->flags |=
+				V4L2_AV1_LOOP_RESTORATION_FLAG_USES_CHROMA_LR;
+	}
+
+	restoration->lr_unit_shift =
+		picture->loop_restoration_fields.bits.lr_unit_shift;
+	restoration->lr_uv_shift =
+		picture->loop_restoration_fields.bits.lr_uv_shift;
+
+	restoration->loop_restoration_size[0] =
+		AV1_RESTORATION_TILESIZE_MAX >> (2 - restoration->lr_unit_shift);
+	restoration->loop_restoration_size[1] =
+		restoration->loop_restoration_size[0] >>
+		restoration->lr_uv_shift;
+	restoration->loop_restoration_size[2] =
+		restoration->loop_restoration_size[1];
+}
+
+static void av1_fill_global_motion(VADecPictureParameterBufferAV1 *picture,
+				   struct v4l2_ctrl_av1_frame *frame)
+{
+	struct v4l2_av1_global_motion *motion = &frame->global_motion;
+	VAWarpedMotionParamsAV1 *wm;
+	unsigned int ref, i;
+
+	for (ref = 0; ref < V4L2_AV1_TOTAL_REFS_PER_FRAME; ref++) {
+		motion->type[ref] = V4L2_AV1_WARP_MODEL_IDENTITY;
+		motion->params[ref][2] = 1 << AV1_WARPEDMODEL_PREC_BITS;
+		motion->params[ref][5] = 1 << AV1_WARPEDMODEL_PREC_BITS;
+	}
+
+	for (ref = V4L2_AV1_REF_LAST_FRAME;
+	     ref < V4L2_AV1_TOTAL_REFS_PER_FRAME; ref++) {
+		wm = &picture->wm[ref - V4L2_AV1_REF_LAST_FRAME];
+
+		motion->type[ref] = (enum v4l2_av1_warp_model)wm->wmtype;
+		for (i = 0; i < 6; i++)
+			motion->params[ref][i] = wm->wmmat[i];
+
+		if (wm->wmtype != VAAV1TransformationIdentity)
+			motion->flags[ref] |=
+				V4L2_AV1_GLOBAL_MOTION_FLAG_IS_GLOBAL;
+		if (wm->wmtype == VAAV1TransformationRotzoom)
+			motion->flags[ref] |=
+				V4L2_AV1_GLOBAL_MOTION_FLAG_IS_ROT_ZOOM;
+		if (wm->wmtype == VAAV1TransformationTranslation)
+			motion->flags[ref] |=
+				V4L2_AV1_GLOBAL_MOTION_FLAG_IS_TRANSLATION;
+
+		if (wm->invalid)
+			motion->invalid |= V4L2_AV1_GLOBAL_MOTION_IS_INVALID(ref);
+	}
+}
+
+static void av1_fill_film_grain(VADecPictureParameterBufferAV1 *picture,
+				struct v4l2_ctrl_av1_film_grain *film_grain)
+{
+	VAFilmGrainStructAV1 *info = &picture->film_grain_info;
+	unsigned int i;
+
+	memset(film_grain, 0, sizeof(*film_grain));
+
+	/* VA always passes the complete set, never a reference to load. */
+	film_grain->flags = V4L2_AV1_FILM_GRAIN_FLAG_APPLY_GRAIN |
+			    V4L2_AV1_FILM_GRAIN_FLAG_UPDATE_GRAIN;
+
+	if (info->film_grain_info_fields.bits.chroma_scaling_from_luma)
+		film_grain->flags |=
+			V4L2_AV1_FILM_GRAIN_FLAG_CHROMA_SCALING_FROM_LUMA;
+	if (info->film_grain_info_fields.bits.overlap_flag)
+		film_grain->flags |= V4L2_AV1_FILM_GRAIN_FLAG_OVERLAP;
+	if (info->film_grain_info_fields.bits.clip_to_restricted_range)
+		film_grain->flags |=
+			V4L2_AV1_FILM_GRAIN_FLAG_CLIP_TO_RESTRICTED_RANGE;
+
+	film_grain->grain_seed = info->grain_seed;
+
+	film_grain->num_y_points = info->num_y_points;
+	memcpy(film_grain->point_y_value, info->point_y_value,
+	       sizeof(info->point_y_value));
+	memcpy(film_grain->point_y_scaling, info->point_y_scaling,
+	       sizeof(info->point_y_scaling));
+
+	film_grain->num_cb_points = info->num_cb_points;
+	memcpy(film_grain->point_cb_value, info->point_cb_value,
+	       sizeof(info->point_cb_value));
+	memcpy(film_grain->point_cb_scaling, info->point_cb_scaling,
+	       sizeof(info->point_cb_scaling));
+
+	film_grain->num_cr_points = info->num_cr_points;
+	memcpy(film_grain->point_cr_value, info->point_cr_value,
+	       sizeof(info->point_cr_value));
+	memcpy(film_grain->point_cr_scaling, info->point_cr_scaling,
+	       sizeof(info->point_cr_scaling));
+
+	film_grain->grain_scaling_minus_8 =
+		info->film_grain_info_fields.bits.grain_scaling_minus_8;
+	film_grain->ar_coeff_lag =
+		info->film_grain_info_fields.bits.ar_coeff_lag;
+
+	for (i = 0; i < sizeof(info->ar_coeffs_y); i++)
+		film_grain->ar_coeffs_y_plus_128[i] = info->ar_coeffs_y[i] + 128;
+
+	for (i = 0; i < sizeof(info->ar_coeffs_cb); i++) {
+		film_grain->ar_coeffs_cb_plus_128[i] =
+			info->ar_coeffs_cb[i] + 128;
+		film_grain->ar_coeffs_cr_plus_128[i] =
+			info->ar_coeffs_cr[i] + 128;
+	}
+
+	film_grain->ar_coeff_shift_minus_6 =
+		info->film_grain_info_fields.bits.ar_coeff_shift_minus_6;
+	film_grain->grain_scale_shift =
+		info->film_grain_info_fields.bits.grain_scale_shift;
+
+	film_grain->cb_mult = info->cb_mult;
+	film_grain->cb_luma_mult = info->cb_luma_mult;
+	film_grain->cb_offset = info->cb_offset;
+	film_grain->cr_mult = info->cr_mult;
+	film_grain->cr_luma_mult = info->cr_luma_mult;
+	film_grain->cr_offset = info->cr_offset;
+}
+
+static void av1_fill_sequence(VADecPictureParameterBufferAV1 *picture,
+			      struct v4l2_ctrl_av1_sequence *sequence)
+{
+	static const unsigned int bit_depths[] = { 8, 10, 12 };
+	unsigned int flags = 0;
+
+	memset(sequence, 0, sizeof(*sequence));
+
+	if (picture->seq_info_fields.fields.still_picture)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_STILL_PICTURE;
+	if (picture->seq_info_fields.fields.use_128x128_superblock)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_USE_128X128_SUPERBLOCK;
+	if (picture->seq_info_fields.fields.enable_filter_intra)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_ENABLE_FILTER_INTRA;
+	if (picture->seq_info_fields.fields.enable_intra_edge_filter)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_ENABLE_INTRA_EDGE_FILTER;
+	if (picture->seq_info_fields.fields.enable_interintra_compound)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_ENABLE_INTERINTRA_COMPOUND;
+	if (picture->seq_info_fields.fields.enable_masked_compound)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_ENABLE_MASKED_COMPOUND;
+	if (picture->seq_info_fields.fields.enable_dual_filter)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_ENABLE_DUAL_FILTER;
+	if (picture->seq_info_fields.fields.enable_order_hint)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_ENABLE_ORDER_HINT;
+	if (picture->seq_info_fields.fields.enable_jnt_comp)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_ENABLE_JNT_COMP;
+	if (picture->seq_info_fields.fields.enable_cdef)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_ENABLE_CDEF;
+	if (picture->seq_info_fields.fields.mono_chrome)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_MONO_CHROME;
+	if (picture->seq_info_fields.fields.color_range)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_COLOR_RANGE;
+	if (picture->seq_info_fields.fields.subsampling_x)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_SUBSAMPLING_X;
+	if (picture->seq_info_fields.fields.subsampling_y)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_SUBSAMPLING_Y;
+	if (picture->seq_info_fields.fields.film_grain_params_present)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_FILM_GRAIN_PARAMS_PRESENT;
+
+	/*
+	 * VA has no equivalent for the remaining sequence flags, so they are
+	 * raised whenever the frame makes use of the tool they enable.
+	 */
+	if (picture->pic_info_fields.bits.allow_warped_motion)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_ENABLE_WARPED_MOTION;
+	if (picture->pic_info_fields.bits.use_ref_frame_mvs)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_ENABLE_REF_FRAME_MVS;
+	if (picture->pic_info_fields.bits.use_superres)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_ENABLE_SUPERRES;
+	if (picture->loop_restoration_fields.bits.yframe_restoration_type ||
+	    picture->loop_restoration_fields.bits.cbframe_restoration_type ||
+	    picture->loop_restoration_fields.bits.crframe_restoration_type)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_ENABLE_RESTORATION;
+	if (picture->u_dc_delta_q != picture->v_dc_delta_q ||
+	    picture->u_ac_delta_q != picture->v_ac_delta_q)
+		flags |= V4L2_AV1_SEQUENCE_FLAG_SEPARATE_UV_DELTA_Q;
+
+	sequence->flags = flags;
+	sequence->seq_profile = picture->profile;
+	sequence->order_hint_bits = picture->order_hint_bits_minus_1 + 1;
+	if (picture->bit_depth_idx < 3)
+		sequence->bit_depth = bit_depths[picture->bit_depth_idx];
+	sequence->max_frame_width_minus_1 = picture->frame_width_minus1;
+	sequence->max_frame_height_minus_1 = picture->frame_height_minus1;
+}
+
+static void av1_fill_frame(VADecPictureParameterBufferAV1 *picture,
+			   struct av1_ref_map *ref_map,
+			   struct v4l2_ctrl_av1_frame *frame)
+{
+	unsigned int upscaled_width = picture->frame_width_minus1 + 1;
+	unsigned int denominator = picture->superres_scale_denominator;
+	unsigned int i;
+
+	memset(frame, 0, sizeof(*frame));
+
+	frame->upscaled_width = upscaled_width;
+	frame->frame_width_minus_1 = upscaled_width - 1;
+	frame->frame_height_minus_1 = picture->frame_height_minus1;
+
+	if (picture->pic_info_fields.bits.use_superres && denominator > 0) {
+		frame->flags |= V4L2_AV1_FRAME_FLAG_USE_SUPERRES;
+		frame->frame_width_minus_1 =
+			(upscaled_width * 8 + denominator / 2) / denominator -
+			1;
+	}
+
+	/* The render size is not carried by VA. */
+	frame->render_width_minus_1 = picture->frame_width_minus1;
+	frame->render_height_minus_1 = picture->frame_height_minus1;
+
+	av1_fill_tile_info(picture, frame);
+
+	frame->quantization.base_q_idx = picture->base_qindex;
+	frame->quantization.delta_q_y_dc = picture->y_dc_delta_q;
+	frame->quantization.delta_q_u_dc = picture->u_dc_delta_q;
+	frame->quantization.delta_q_u_ac = picture->u_ac_delta_q;
+	frame->quantization.delta_q_v_dc = picture->v_dc_delta_q;
+	frame->quantization.delta_q_v_ac = picture->v_ac_delta_q;
+	frame->quantization.qm_y = picture->qmatrix_fields.bits.qm_y;
+	frame->quantization.qm_u = picture->qmatrix_fields.bits.qm_u;
+	frame->quantization.qm_v = picture->qmatrix_fields.bits.qm_v;
+	frame->quantization.delta_q_res =
+		picture->mode_control_fields.bits.log2_delta_q_res;
+
+	if (picture->u_dc_delta_q != picture->v_dc_delta_q ||
+	    picture->u_ac_delta_q != picture->v_ac_delta_q)
+		frame->quantization.flags |=
+			V4L2_AV1_QUANTIZATION_FLAG_DIFF_UV_DELTA;
+	if (picture->qmatrix_fields.bits.using_qmatrix)
+		frame->quantization.flags |=
+			V4L2_AV1_QUANTIZATION_FLAG_USING_QMATRIX;
+	if (picture->mode_control_fields.bits.delta_q_present_flag)
+		frame->quantization.flags |=
+			V4L2_AV1_QUANTIZATION_FLAG_DELTA_Q_PRESENT;
+
+	frame->superres_denom = denominator;
+
+	av1_fill_segmentation(picture, frame);
+
+	frame->loop_filter.level[0] = picture->filter_level[0];
+	frame->loop_filter.level[1] = picture->filter_level[1];
+	frame->loop_filter.level[2] = picture->filter_level_u;
+	frame->loop_filter.level[3] = picture->filter_level_v;
+	frame->loop_filter.sharpness =
+		picture->loop_filter_info_fields.bits.sharpness_level;
+	memcpy(frame->loop_filter.ref_deltas, picture->ref_deltas,
+	       sizeof(frame->loop_filter.ref_deltas));
+	memcpy(frame->loop_filter.mode_deltas, picture->mode_deltas,
+	       sizeof(frame->loop_filter.mode_deltas));
+	frame->loop_filter.delta_lf_res =
+		picture->mode_control_fields.bits.log2_delta_lf_res;
+
+	if (picture->loop_filter_info_fields.bits.mode_ref_delta_enabled)
+		frame->loop_filter.flags |=
+			V4L2_AV1_LOOP_FILTER_FLAG_DELTA_ENABLED;
+	if (picture->loop_filter_info_fields.bits.mode_ref_delta_update)
+		frame->loop_filter.flags |=
+			V4L2_AV1_LOOP_FILTER_FLAG_DELTA_UPDATE;
+	if (picture->mode_control_fields.bits.delta_lf_present_flag)
+		frame->loop_filter.flags |=
+			V4L2_AV1_LOOP_FILTER_FLAG_DELTA_LF_PRESENT;
+	if (picture->mode_control_fields.bits.delta_lf_multi)
+		frame->loop_filter.flags |=
+			V4L2_AV1_LOOP_FILTER_FLAG_DELTA_LF_MULTI;
+
+	/* VA packs the primary and secondary strengths as pri << 2 | sec. */
+	frame->cdef.damping_minus_3 = picture->cdef_damping_minus_3;
+	frame->cdef.bits = picture->cdef_bits;
+	for (i = 0; i < V4L2_AV1_CDEF_MAX; i++) {
+		frame->cdef.y_pri_strength[i] = picture->cdef_y_strengths[i] >> 2;
+		frame->cdef.y_sec_strength[i] = picture->cdef_y_strengths[i] & 3;
+		frame->cdef.uv_pri_strength[i] =
+			picture->cdef_uv_strengths[i] >> 2;
+		frame->cdef.uv_sec_strength[i] =
+			picture->cdef_uv_strengths[i] & 3;
+	}
+
+	frame->primary_ref_frame = picture->primary_ref_frame;
+
+	av1_fill_loop_restoration(picture, frame);
+	av1_fill_global_motion(picture, frame);
+
+	if (picture->pic_info_fields.bits.show_frame)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_SHOW_FRAME;
+	if (picture->pic_info_fields.bits.showable_frame)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_SHOWABLE_FRAME;
+	if (picture->pic_info_fields.bits.error_resilient_mode)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_ERROR_RESILIENT_MODE;
+	if (picture->pic_info_fields.bits.disable_cdf_update)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_DISABLE_CDF_UPDATE;
+	if (picture->pic_info_fields.bits.allow_screen_content_tools)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_ALLOW_SCREEN_CONTENT_TOOLS;
+	if (picture->pic_info_fields.bits.force_integer_mv)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_FORCE_INTEGER_MV;
+	if (picture->pic_info_fields.bits.allow_intrabc)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_ALLOW_INTRABC;
+	if (picture->pic_info_fields.bits.allow_high_precision_mv)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_ALLOW_HIGH_PRECISION_MV;
+	if (picture->pic_info_fields.bits.is_motion_mode_switchable)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_IS_MOTION_MODE_SWITCHABLE;
+	if (picture->pic_info_fields.bits.use_ref_frame_mvs)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_USE_REF_FRAME_MVS;
+	if (picture->pic_info_fields.bits.disable_frame_end_update_cdf)
+		frame->flags |=
+			V4L2_AV1_FRAME_FLAG_DISABLE_FRAME_END_UPDATE_CDF;
+	if (picture->pic_info_fields.bits.allow_warped_motion)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_ALLOW_WARPED_MOTION;
+	if (picture->mode_control_fields.bits.reference_select)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_REFERENCE_SELECT;
+	if (picture->mode_control_fields.bits.reduced_tx_set_used)
+		frame->flags |= V4L2_AV1_FRAME_FLAG_REDUCED_TX_SET;
+
+	av1_fill_skip_mode(picture, ref_map, frame);
+
+	frame->frame_type = picture->pic_info_fields.bits.frame_type;
+	frame->order_hint = picture->order_hint;
+	frame->interpolation_filter = picture->interp_filter;
+	frame->tx_mode = picture->mode_control_fields.bits.tx_mode;
+
+	for (i = 0; i < V4L2_AV1_REFS_PER_FRAME; i++) {
+		frame->ref_frame_idx[i] = picture->ref_frame_idx[i];
+		frame->order_hints[V4L2_AV1_REF_LAST_FRAME + i] =
+			ref_map->order_hints[picture->ref_frame_idx[i]];
+	}
+
+	for (i = 0; i < V4L2_AV1_TOTAL_REFS_PER_FRAME; i++)
+		frame->reference_frame_ts[i] = ref_map->timestamps[i];
+
+	/*
+	 * VA does not carry refresh_frame_flags and only passes the tile data,
+	 * so the frame header cannot be parsed for it either. Only shown key
+	 * frames, which refresh every slot, can be told apart. Drivers that
+	 * update per-slot state from the flags would go wrong on every other
+	 * frame, so AV1 is only exposed on those that find references through
+	 * reference_frame_ts alone (see av1_supported).
+	 */
+	if (frame->frame_type == V4L2_AV1_KEY_FRAME &&
+	    (frame->flags & V4L2_AV1_FRAME_FLAG_SHOW_FRAME))
+		frame->refresh_frame_flags = 0xff;
+}
+
+int av1_set_controls(struct request_data *driver_data,
+		     struct object_context *context_object,
+		     struct object_surface *surface_object)
+{
+	VADecPictureParameterBufferAV1 *picture =
+		&surface_object->params->av1.picture;
+	struct v4l2_ctrl_av1_tile_group_entry
+		tile_group_entries[AV1_MAX_TILES];
+	struct v4l2_ctrl_av1_film_grain film_grain;
+	struct v4l2_ctrl_av1_sequence sequence;
+	struct v4l2_ctrl_av1_frame frame;
+	struct av1_tile *tile;
+	unsigned int tiles_count = surface_object->params->av1.tiles_count;
+	unsigned int i;
+	int rc;
+
+	if (tiles_count == 0) {
+		request_log("No AV1 tile to decode\n");
+		return -1;
+	}
+
+	av1_update_ref_map(driver_data, &context_object->av1_ref_map, picture);
+
+	av1_fill_sequence(picture, &sequence);
+	av1_fill_frame(picture, &context_object->av1_ref_map, &frame);
+
+	for (i = 0; i < tiles_count; i++) {
+		tile = &surface_object->params->av1.tiles[i];
+
+		if (tile->offset + tile->size > surface_object->slices_size) {
+			request_log("AV1 tile %u exceeds the slice data\n", i);
+			return -1;
+		}
+
+		tile_group_entries[i].tile_offset = tile->offset;
+		tile_group_entries[i].tile_size = tile->size;
+		tile_group_entries[i].tile_row = tile->row;
+		tile_group_entries[i].tile_col = tile->column;
+	}
+
+	surface_object->params->av1.tiles_count = 0;
+	surface_object->order_hint = picture->order_hint;
+
+	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
+			      V4L2_CID_STATELESS_AV1_SEQUENCE, &sequence,
+			      sizeof(sequence));
+	if (rc < 0)
+		return -1;
+
+	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
+			      V4L2_CID_STATELESS_AV1_FRAME, &frame,
+			      sizeof(frame));
+	if (rc < 0)
+		return -1;
+
+	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
+			      V4L2_CID_STATELESS_AV1_TILE_GROUP_ENTRY,
+			      tile_group_entries,
+			      tiles_count * sizeof(tile_group_entries[0]));
+	if (rc < 0)
+		return -1;
+
+	if (picture->seq_info_fields.fields.film_grain_params_present &&
+	    picture->film_grain_info.film_grain_info_fields.bits.apply_grain) {
+		av1_fill_film_grain(picture, &film_grain);
+
+		rc = v4l2_set_control(driver_data->video_fd,
+				      surface_object->request_fd,
+				      V4L2_CID_STATELESS_AV1_FILM_GRAIN,
+				      &film_grain, sizeof(film_grain));
+		if (rc < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+#endif
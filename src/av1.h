@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026 libva-v4l2-request contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _AV1_H_
+#define _AV1_H_
+
+#include <stdint.h>
+
+#include <va/va.h>
+
+struct object_context;
+struct object_surface;
+struct request_data;
+
+/* AV1 decoding was introduced with VA-API 1.8. */
+#if VA_CHECK_VERSION(1, 8, 0)
+
+#define AV1_MAX_TILES		512
+#define AV1_NUM_REF_FRAMES	8
+
+struct av1_tile {
+	unsigned int offset;
+	unsigned int size;
+	unsigned int row;
+	unsigned int column;
+};
+
+/* Reference frame slots as passed to the decoder for the last frame. */
+struct av1_ref_map {
+	VASurfaceID surfaces_ids[AV1_NUM_REF_FRAMES];
+	unsigned int order_hints[AV1_NUM_REF_FRAMES];
+	uint64_t timestamps[AV1_NUM_REF_FRAMES];
+};
+
+VAStatus av1_store_slice_params(struct object_surface *surface_object,
+				VASliceParameterBufferAV1 *slices,
+				unsigned int count);
+int av1_set_controls(struct request_data *driver_data,
+		     struct object_context *context,
+		     struct object_surface *surface_object);
+
+#endif
+
+#endif
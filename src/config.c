@@ -37,12 +37,74 @@
 #include <mpeg2-ctrls.h>
 #include <h264-ctrls.h>
 #include <hevc-ctrls.h>
+#include <av1-ctrls.h>
 
 #include "utils.h"
 #include "v4l2.h"
+#include "video.h"
 
 #include "autoconfig.h"
 
+/* Picture size the decoder is set up with while probing formats. */
+#define CONFIG_PROBE_WIDTH	1920
+#define CONFIG_PROBE_HEIGHT	1088
+
+static unsigned int config_rt_format(VAProfile profile)
+{
+	switch (profile) {
+	case VAProfileHEVCMain10:
+#if VA_CHECK_VERSION(1, 18, 0)
+	case VAProfileH264High10:
+#endif
+		/* 10-bit profiles also cover 8-bit streams. */
+		return VA_RT_FORMAT_YUV420 | VA_RT_FORMAT_YUV420_10;
+
+	case VAProfileVP9Profile2:
+		return VA_RT_FORMAT_YUV420_10;
+
+	default:
+		return VA_RT_FORMAT_YUV420;
+	}
+}
+
+static unsigned int config_pixelformat(VAProfile profile)
+{
+	switch (profile) {
+	case VAProfileMPEG2Simple:
+	case VAProfileMPEG2Main:
+		return V4L2_PIX_FMT_MPEG2_SLICE;
+
+	case VAProfileH264Main:
+	case VAProfileH264High:
+	case VAProfileH264ConstrainedBaseline:
+	case VAProfileH264MultiviewHigh:
+	case VAProfileH264StereoHigh:
+#if VA_CHECK_VERSION(1, 18, 0)
+	case VAProfileH264High10:
+#endif
+		return V4L2_PIX_FMT_H264_SLICE;
+
+	case VAProfileHEVCMain:
+	case VAProfileHEVCMain10:
+		return V4L2_PIX_FMT_HEVC_SLICE;
+
+	case VAProfileVP8Version0_3:
+		return V4L2_PIX_FMT_VP8_FRAME;
+
+	case VAProfileVP9Profile0:
+	case VAProfileVP9Profile2:
+		return V4L2_PIX_FMT_VP9_FRAME;
+
+#if VA_CHECK_VERSION(1, 8, 0)
+	case VAProfileAV1Profile0:
+		return V4L2_PIX_FMT_AV1_FRAME;
+#endif
+
+	default:
+		return 0;
+	}
+}
+
 VAStatus RequestCreateConfig(VADriverContextP context, VAProfile profile,
 			     VAEntrypoint entrypoint,
 			     VAConfigAttrib *attributes, int attributes_count,
@@ -61,15 +123,34 @@ VAStatus RequestCreateConfig(VADriverContextP context, VAProfile profile,
 	case VAProfileH264ConstrainedBaseline:
 	case VAProfileH264MultiviewHigh:
 	case VAProfileH264StereoHigh:
-		case VAProfileHEVCMain:
+	case VAProfileHEVCMain:
+	case VAProfileHEVCMain10:
+	case VAProfileVP8Version0_3:
+	case VAProfileVP9Profile0:
+	case VAProfileVP9Profile2:
+#if VA_CHECK_VERSION(1, 18, 0)
+	case VAProfileH264High10:
+#endif
 		if (entrypoint != VAEntrypointVLD)
 			return VA_STATUS_ERROR_UNSUPPORTED_ENTRYPOINT;
 		break;
 
+#if VA_CHECK_VERSION(1, 8, 0)
+	case VAProfileAV1Profile0:
+		if (!driver_data->av1_supported)
+			return VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
+		if (entrypoint != VAEntrypointVLD)
+			return VA_STATUS_ERROR_UNSUPPORTED_ENTRYPOINT;
+		break;
+#endif
+
 	default:
 		return VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
 	}
 
+	/* Surfaces are created for the codec of the last config. */
+	driver_data->codec_pixfmt = config_pixelformat(profile);
+
 	if (attributes_count > V4L2_REQUEST_MAX_CONFIG_ATTRIBUTES)
 		attributes_count = V4L2_REQUEST_MAX_CONFIG_ATTRIBUTES;
 
@@ -81,7 +162,7 @@ VAStatus RequestCreateConfig(VADriverContextP context, VAProfile profile,
 	config_object->profile = profile;
 	config_object->entrypoint = entrypoint;
 	config_object->attributes[0].type = VAConfigAttribRTFormat;
-	config_object->attributes[0].value = VA_RT_FORMAT_YUV420;
+	config_object->attributes[0].value = config_rt_format(profile);
 	config_object->attributes_count = 1;
 
 	for (i = 1; i < attributes_count; i++) {
@@ -111,6 +192,119 @@ VAStatus RequestDestroyConfig(VADriverContextP context, VAConfigID config_id)
 	return VA_STATUS_SUCCESS;
 }
 
+/* 10-bit profiles are only exposed when a 10-bit capture format is listed. */
+/*
+ * Drivers only enumerate the capture formats that fit the coded stream, which
+ * they learn from the output format and the sequence level controls. Both are
+ * set up for a stream of the given bit depth before a capture format is looked
+ * for or selected.
+ */
+int config_set_bit_depth(struct request_data *driver_data,
+			 unsigned int pixelformat, unsigned int bit_depth,
+			 unsigned int width, unsigned int height)
+{
+	struct v4l2_ctrl_h264_sps h264_sps;
+	struct v4l2_ctrl_hevc_sps hevc_sps;
+	struct v4l2_ctrl_vp9_frame vp9_frame;
+	int rc;
+
+	if (pixelformat == 0)
+		return -1;
+
+	rc = v4l2_set_format(driver_data->video_fd,
+			     V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, pixelformat,
+			     width, height);
+	if (rc < 0)
+		return -1;
+
+	switch (pixelformat) {
+	case V4L2_PIX_FMT_H264_SLICE:
+		memset(&h264_sps, 0, sizeof(h264_sps));
+		h264_sps.profile_idc = bit_depth > 8 ? 110 : 100;
+		h264_sps.level_idc = 51;
+		h264_sps.chroma_format_idc = 1;
+		h264_sps.bit_depth_luma_minus8 = bit_depth - 8;
+		h264_sps.bit_depth_chroma_minus8 = bit_depth - 8;
+		h264_sps.max_num_ref_frames = 1;
+		h264_sps.pic_width_in_mbs_minus1 = (width + 15) / 16 - 1;
+		h264_sps.pic_height_in_map_units_minus1 =
+			(height + 15) / 16 - 1;
+		h264_sps.flags = V4L2_H264_SPS_FLAG_FRAME_MBS_ONLY;
+
+		return v4l2_set_control(driver_data->video_fd, -1,
+					V4L2_CID_STATELESS_H264_SPS,
+					&h264_sps, sizeof(h264_sps));
+
+	case V4L2_PIX_FMT_HEVC_SLICE:
+		memset(&hevc_sps, 0, sizeof(hevc_sps));
+		hevc_sps.chroma_format_idc = 1;
+		hevc_sps.bit_depth_luma_minus8 = bit_depth - 8;
+		hevc_sps.bit_depth_chroma_minus8 = bit_depth - 8;
+		hevc_sps.pic_width_in_luma_samples = width;
+		hevc_sps.pic_height_in_luma_samples = height;
+		hevc_sps.log2_max_pic_order_cnt_lsb_minus4 = 4;
+		hevc_sps.log2_diff_max_min_luma_coding_block_size = 3;
+		hevc_sps.log2_diff_max_min_luma_transform_block_size = 3;
+
+		return v4l2_set_control(driver_data->video_fd, -1,
+					V4L2_CID_STATELESS_HEVC_SPS,
+					&hevc_sps, sizeof(hevc_sps));
+
+	case V4L2_PIX_FMT_VP9_FRAME:
+		memset(&vp9_frame, 0, sizeof(vp9_frame));
+		vp9_frame.profile = bit_depth > 8 ? 2 : 0;
+		vp9_frame.bit_depth = bit_depth;
+		vp9_frame.frame_width_minus_1 = width - 1;
+		vp9_frame.frame_height_minus_1 = height - 1;
+		vp9_frame.render_width_minus_1 = width - 1;
+		vp9_frame.render_height_minus_1 = height - 1;
+		vp9_frame.flags = V4L2_VP9_FRAME_FLAG_KEY_FRAME |
+				  V4L2_VP9_FRAME_FLAG_X_SUBSAMPLING |
+				  V4L2_VP9_FRAME_FLAG_Y_SUBSAMPLING;
+
+		return v4l2_set_control(driver_data->video_fd, -1,
+					V4L2_CID_STATELESS_VP9_FRAME,
+					&vp9_frame, sizeof(vp9_frame));
+
+	default:
+		return 0;
+	}
+}
+
+static bool config_10bit_supported(struct request_data *driver_data,
+				   unsigned int pixelformat)
+{
+	struct video_format *video_format;
+	unsigned int capture_type;
+	unsigned int i;
+	bool found = false;
+	int rc;
+
+	rc = config_set_bit_depth(driver_data, pixelformat, 10,
+				  CONFIG_PROBE_WIDTH, CONFIG_PROBE_HEIGHT);
+	if (rc < 0)
+		return false;
+
+	for (i = 0; (video_format = video_format_get(i)) != NULL; i++) {
+		if (video_format->bit_depth <= 8)
+			continue;
+
+		capture_type = v4l2_type_video_capture(video_format->v4l2_mplane);
+
+		if (v4l2_find_format(driver_data->video_fd, capture_type,
+				     video_format->v4l2_format)) {
+			found = true;
+			break;
+		}
+	}
+
+	/* Leave the decoder set up for 8-bit streams again. */
+	config_set_bit_depth(driver_data, pixelformat, 8, CONFIG_PROBE_WIDTH,
+			     CONFIG_PROBE_HEIGHT);
+
+	return found;
+}
+
 VAStatus RequestQueryConfigProfiles(VADriverContextP context,
 				    VAProfile *profiles, int *profiles_count)
 {
@@ -129,20 +323,56 @@ VAStatus RequestQueryConfigProfiles(VADriverContextP context,
 	found = v4l2_find_format(driver_data->video_fd,
 				 V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
 				 V4L2_PIX_FMT_H264_SLICE);
-	if (found && index < (V4L2_REQUEST_MAX_CONFIG_ATTRIBUTES - 5)) {
+	if (found && index < (V4L2_REQUEST_MAX_CONFIG_ATTRIBUTES - 6)) {
 		profiles[index++] = VAProfileH264Main;
 		profiles[index++] = VAProfileH264High;
 		profiles[index++] = VAProfileH264ConstrainedBaseline;
 		profiles[index++] = VAProfileH264MultiviewHigh;
 		profiles[index++] = VAProfileH264StereoHigh;
+#if VA_CHECK_VERSION(1, 18, 0)
+		if (config_10bit_supported(driver_data,
+					   V4L2_PIX_FMT_H264_SLICE))
+			profiles[index++] = VAProfileH264High10;
+#endif
 	}
 
 	found = v4l2_find_format(driver_data->video_fd,
 				 V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
 				 V4L2_PIX_FMT_HEVC_SLICE);
-	if (found && index < (V4L2_REQUEST_MAX_CONFIG_ATTRIBUTES - 1))
+	if (found && index < (V4L2_REQUEST_MAX_CONFIG_ATTRIBUTES - 2)) {
 		profiles[index++] = VAProfileHEVCMain;
 
+		if (config_10bit_supported(driver_data,
+					   V4L2_PIX_FMT_HEVC_SLICE))
+			profiles[index++] = VAProfileHEVCMain10;
+	}
+
+	found = v4l2_find_format(driver_data->video_fd,
+				 V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+				 V4L2_PIX_FMT_VP8_FRAME);
+	if (found && index < (V4L2_REQUEST_MAX_CONFIG_ATTRIBUTES - 1))
+		profiles[index++] = VAProfileVP8Version0_3;
+
+	found = v4l2_find_format(driver_data->video_fd,
+				 V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+				 V4L2_PIX_FMT_VP9_FRAME);
+	if (found && index < (V4L2_REQUEST_MAX_CONFIG_ATTRIBUTES - 2)) {
+		profiles[index++] = VAProfileVP9Profile0;
+
+		if (config_10bit_supported(driver_data,
+					   V4L2_PIX_FMT_VP9_FRAME))
+			profiles[index++] = VAProfileVP9Profile2;
+	}
+
+#if VA_CHECK_VERSION(1, 8, 0)
+	found = v4l2_find_format(driver_data->video_fd,
+				 V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+				 V4L2_PIX_FMT_AV1_FRAME);
+	if (found && driver_data->av1_supported &&
+	    index < (V4L2_REQUEST_MAX_CONFIG_ATTRIBUTES - 1))
+		profiles[index++] = VAProfileAV1Profile0;
+#endif
+
 	*profiles_count = index;
 
 	return VA_STATUS_SUCCESS;
@@ -162,6 +392,16 @@ VAStatus RequestQueryConfigEntrypoints(VADriverContextP context,
 	case VAProfileH264MultiviewHigh:
 	case VAProfileH264StereoHigh:
 	case VAProfileHEVCMain:
+	case VAProfileHEVCMain10:
+	case VAProfileVP8Version0_3:
+	case VAProfileVP9Profile0:
+	case VAProfileVP9Profile2:
+#if VA_CHECK_VERSION(1, 8, 0)
+	case VAProfileAV1Profile0:
+#endif
+#if VA_CHECK_VERSION(1, 18, 0)
+	case VAProfileH264High10:
+#endif
 		entrypoints[0] = VAEntrypointVLD;
 		*entrypoints_count = 1;
 		break;
@@ -215,7 +455,7 @@ VAStatus RequestGetConfigAttributes(VADriverContextP context, VAProfile profile,
 	for (i = 0; i < attributes_count; i++) {
 		switch (attributes[i].type) {
 		case VAConfigAttribRTFormat:
-			attributes[i].value = VA_RT_FORMAT_YUV420;
+			attributes[i].value = config_rt_format(profile);
 			break;
 		default:
 			attributes[i].value = VA_ATTRIB_NOT_SUPPORTED;
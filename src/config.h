@@ -45,6 +45,9 @@ struct object_config {
 	int attributes_count;
 };
 
+int config_set_bit_depth(struct request_data *driver_data,
+			 unsigned int pixelformat, unsigned int bit_depth,
+			 unsigned int width, unsigned int height);
 VAStatus RequestCreateConfig(VADriverContextP context, VAProfile profile,
 			     VAEntrypoint entrypoint,
 			     VAConfigAttrib *attributes, int attributes_count,
@@ -31,6 +31,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <assert.h>
 
@@ -42,12 +43,398 @@
 #include <mpeg2-ctrls.h>
 #include <h264-ctrls.h>
 #include <hevc-ctrls.h>
+#include <av1-ctrls.h>
 
+#include "media.h"
 #include "utils.h"
 #include "v4l2.h"
 
 #include "autoconfig.h"
 
+/*
+ * The sequence number goes into the timestamp microseconds, which is what
+ * V4L2 carries along from the OUTPUT to the CAPTURE buffer. It is unique and
+ * monotonic for the whole context, unlike the wall clock.
+ */
+void context_stamp_surface(struct object_context *context_object,
+			   struct object_surface *surface_object)
+{
+	uint64_t sequence = ++context_object->sequence;
+
+	surface_object->sequence = sequence;
+	surface_object->timestamp.tv_sec = sequence / 1000000;
+	surface_object->timestamp.tv_usec = sequence % 1000000;
+
+	context_object->sequence_surfaces[sequence %
+					  CONTEXT_SEQUENCE_SURFACES] =
+		surface_object->base.id;
+}
+
+struct object_surface *context_find_surface(struct request_data *driver_data,
+					    struct object_context *context_object,
+					    struct timeval *timestamp)
+{
+	struct object_surface *surface_object;
+	uint64_t sequence;
+
+	sequence = (uint64_t)timestamp->tv_sec * 1000000 + timestamp->tv_usec;
+
+	surface_object = SURFACE(driver_data,
+				 context_object->sequence_surfaces[
+					 sequence % CONTEXT_SEQUENCE_SURFACES]);
+	if (surface_object == NULL || surface_object->sequence != sequence)
+		return NULL;
+
+	return surface_object;
+}
+
+static unsigned int source_class(unsigned int size)
+{
+	unsigned int class = 0;
+
+	while (class < CONTEXT_SOURCE_CLASSES - 1 &&
+	       (SOURCE_SIZE_DEFAULT << class) < size)
+		class++;
+
+	return class;
+}
+
+static int source_pool_take(struct object_context *context_object,
+			    unsigned int class_min, unsigned int class_max,
+			    unsigned int size,
+			    struct context_source_buffer *buffer)
+{
+	unsigned int class;
+	unsigned int *count;
+	unsigned int i;
+
+	for (class = class_min; class <= class_max; class++) {
+		count = &context_object->source_pool_count[class];
+
+		for (i = 0; i < *count; i++) {
+			if (context_object->source_pool[class][i].size < size)
+				continue;
+
+			*buffer = context_object->source_pool[class][i];
+			context_object->source_pool[class][i] =
+				context_object->source_pool[class][*count - 1];
+			(*count)--;
+
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int source_pool_create(struct request_data *driver_data,
+			      unsigned int size,
+			      struct context_source_buffer *buffer)
+{
+	struct video_format *video_format = driver_data->video_format;
+	unsigned int output_type;
+	unsigned int length;
+	unsigned int offset;
+	unsigned int index;
+	void *data;
+	int rc;
+
+	output_type = v4l2_type_video_output(video_format->v4l2_mplane);
+
+	rc = v4l2_create_buffers(driver_data->video_fd, output_type, 1, size,
+				 &index, NULL);
+	if (rc < 0)
+		return -1;
+
+	rc = v4l2_query_buffer(driver_data->video_fd, output_type, index,
+			       &length, &offset, 1);
+	if (rc < 0)
+		return -1;
+
+	data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    driver_data->video_fd, offset);
+	if (data == MAP_FAILED)
+		return -1;
+
+	buffer->index = index;
+	buffer->data = data;
+	buffer->size = length;
+
+	return 0;
+}
+
+/*
+ * OUTPUT buffers start out at SOURCE_SIZE_DEFAULT and move up power of two
+ * size classes when a picture does not fit, keeping what was already copied.
+ * V4L2 cannot free a single buffer, so the one given up by the surface goes
+ * to the context pool and is handed out again to the next surface that needs
+ * a buffer of its class. A spare buffer of the right class is preferred, then
+ * a new one, then any larger spare buffer when the OUTPUT queue is full.
+ */
+int context_reserve_source(struct request_data *driver_data,
+			   struct object_context *context_object,
+			   struct object_surface *surface_object,
+			   unsigned int size)
+{
+	struct context_source_buffer buffer;
+	unsigned int length;
+	unsigned int class;
+	unsigned int *count;
+	int rc;
+
+	if (size <= surface_object->source_size)
+		return 0;
+
+	if (driver_data->video_format == NULL)
+		return -1;
+
+	if (size > SOURCE_SIZE_LIMIT) {
+		request_log("Bitstream of %u bytes is too large\n", size);
+		return -1;
+	}
+
+	length = SOURCE_SIZE_DEFAULT;
+	while (length < size)
+		length *= 2;
+
+	class = source_class(length);
+
+	rc = source_pool_take(context_object, class, class, size, &buffer);
+	if (rc < 0)
+		rc = source_pool_create(driver_data, length, &buffer);
+	if (rc < 0)
+		rc = source_pool_take(context_object, class + 1,
+				      CONTEXT_SOURCE_CLASSES - 1, size,
+				      &buffer);
+	if (rc < 0 || buffer.size < size) {
+		request_log("Unable to grow source buffer to %u bytes\n", size);
+		return -1;
+	}
+
+	memcpy(buffer.data, surface_object->source_data,
+	       surface_object->slices_size);
+
+	class = source_class(surface_object->source_size);
+	count = &context_object->source_pool_count[class];
+
+	if (*count < CONTEXT_SOURCE_POOL_SIZE) {
+		context_object->source_pool[class][*count].index =
+			surface_object->source_index;
+		context_object->source_pool[class][*count].data =
+			surface_object->source_data;
+		context_object->source_pool[class][*count].size =
+			surface_object->source_size;
+		(*count)++;
+	} else {
+		munmap(surface_object->source_data,
+		       surface_object->source_size);
+	}
+
+	surface_object->source_index = buffer.index;
+	surface_object->source_data = buffer.data;
+	surface_object->source_size = buffer.size;
+
+	context_object->source_grow_count++;
+
+	request_log("Grew source buffer to %u bytes (growth %u, peak %u)\n",
+		    length, context_object->source_grow_count,
+		    context_object->source_size_peak);
+
+	return 0;
+}
+
+/*
+ * Slice requests and their OUTPUT buffers are kept for the following
+ * pictures. Like with surfaces, a buffer that is too small for a slice is
+ * replaced and stays allocated until the context is destroyed.
+ */
+struct context_slice_request *
+context_reserve_slice(struct request_data *driver_data,
+		      struct object_context *context_object,
+		      unsigned int slot, unsigned int size)
+{
+	struct video_format *video_format = driver_data->video_format;
+	struct context_slice_request *slice_request;
+	unsigned int output_type;
+	unsigned int length;
+	unsigned int offset;
+	unsigned int index;
+	unsigned int count;
+	void *data;
+	int rc;
+
+	if (video_format == NULL)
+		return NULL;
+
+	if (slot >= context_object->slice_requests_count) {
+		count = context_object->slice_requests_count > 0 ?
+			context_object->slice_requests_count * 2 : 4;
+		while (count <= slot)
+			count *= 2;
+
+		slice_request = realloc(context_object->slice_requests,
+					count * sizeof(*slice_request));
+		if (slice_request == NULL)
+			return NULL;
+
+		context_object->slice_requests = slice_request;
+
+		while (context_object->slice_requests_count < count) {
+			slice_request = &context_object->slice_requests[
+				context_object->slice_requests_count++];
+			slice_request->data = NULL;
+			slice_request->size = 0;
+			slice_request->slice_size = 0;
+			slice_request->request_fd = -1;
+		}
+	}
+
+	slice_request = &context_object->slice_requests[slot];
+
+	if (slice_request->request_fd < 0) {
+		slice_request->request_fd =
+			media_request_alloc(driver_data->media_fd);
+		if (slice_request->request_fd < 0)
+			return NULL;
+	}
+
+	if (size <= slice_request->size)
+		return slice_request;
+
+	if (size > SOURCE_SIZE_LIMIT) {
+		request_log("Slice of %u bytes is too large\n", size);
+		return NULL;
+	}
+
+	length = SLICE_SIZE_DEFAULT;
+	while (length < size)
+		length *= 2;
+
+	output_type = v4l2_type_video_output(video_format->v4l2_mplane);
+
+	rc = v4l2_create_buffers(driver_data->video_fd, output_type, 1, length,
+				 &index, NULL);
+	if (rc < 0)
+		return NULL;
+
+	rc = v4l2_query_buffer(driver_data->video_fd, output_type, index,
+			       &length, &offset, 1);
+	if (rc < 0 || length < size)
+		return NULL;
+
+	data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    driver_data->video_fd, offset);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	if (slice_request->data != NULL)
+		munmap(slice_request->data, slice_request->size);
+
+	slice_request->index = index;
+	slice_request->data = data;
+	slice_request->size = length;
+
+	return slice_request;
+}
+
+/*
+ * Queues the first slice of the picture, of the given size, with the request
+ * of the surface and then the count slice requests filled by the codec, back
+ * to back. Every slice but the last is queued with the capture buffer held,
+ * so that the picture is only handed back once its last slice was decoded.
+ * With hold_capture, the last slice of a first field holds it too, until the
+ * second field is decoded. The requests are waited for in surface_sync.
+ */
+int context_queue_slices(struct request_data *driver_data,
+			 struct object_context *context_object,
+			 struct object_surface *surface_object,
+			 unsigned int size, unsigned int count,
+			 bool hold_capture)
+{
+	struct context_slice_request *slice_request;
+	unsigned int output_type;
+	unsigned int flags;
+	unsigned int i;
+	int rc;
+
+	output_type =
+		v4l2_type_video_output(driver_data->video_format->v4l2_mplane);
+
+	flags = count > 0 || hold_capture ?
+		V4L2_BUF_FLAG_M2M_HOLD_CAPTURE_BUF : 0;
+
+	rc = v4l2_queue_buffer(driver_data->video_fd,
+			       surface_object->request_fd, output_type,
+			       &surface_object->timestamp,
+			       surface_object->source_index, size, flags, 1);
+	if (rc < 0)
+		return -1;
+
+	rc = media_request_queue(surface_object->request_fd);
+	if (rc < 0)
+		return -1;
+
+	surface_object->request_queued = true;
+
+	for (i = 0; i < count; i++) {
+		slice_request = &context_object->slice_requests[i];
+
+		flags = (i + 1) < count || hold_capture ?
+			V4L2_BUF_FLAG_M2M_HOLD_CAPTURE_BUF : 0;
+
+		rc = v4l2_queue_buffer(driver_data->video_fd,
+				       slice_request->request_fd, output_type,
+				       &surface_object->timestamp,
+				       slice_request->index,
+				       slice_request->slice_size, flags, 1);
+		if (rc < 0)
+			return -1;
+
+		rc = media_request_queue(slice_request->request_fd);
+		if (rc < 0)
+			return -1;
+
+		context_object->slice_requests_queued = i + 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Called with the queue lock held, once the request of the surface has
+ * completed. The slice requests complete in the order they were queued in.
+ */
+int context_complete_slices(struct request_data *driver_data,
+			    struct object_context *context_object)
+{
+	struct context_slice_request *slice_request;
+	unsigned int output_type;
+	unsigned int i;
+	int status = 0;
+	int rc;
+
+	output_type =
+		v4l2_type_video_output(driver_data->video_format->v4l2_mplane);
+
+	for (i = 0; i < context_object->slice_requests_queued; i++) {
+		slice_request = &context_object->slice_requests[i];
+
+		rc = media_request_wait_completion(slice_request->request_fd);
+		if (rc >= 0)
+			rc = media_request_reinit(slice_request->request_fd);
+		if (rc >= 0)
+			rc = v4l2_dequeue_buffer(driver_data->video_fd, -1,
+						 output_type,
+						 slice_request->index, 1, NULL);
+		if (rc < 0)
+			status = -1;
+	}
+
+	context_object->slice_requests_queued = 0;
+
+	return status;
+}
+
 VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 			      int picture_width, int picture_height, int flags,
 			      VASurfaceID *surfaces_ids, int surfaces_count,
@@ -67,8 +454,10 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 	unsigned int output_type, capture_type;
 	unsigned int pixelformat;
 	unsigned int index_base;
+	unsigned int capabilities;
 	unsigned int index;
 	unsigned int i;
+	int decode_mode;
 	int rc;
 
 	video_format = driver_data->video_format;
@@ -90,7 +479,26 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
 		goto error;
 	}
+	pthread_mutex_init(&context_object->mutex, NULL);
+	pthread_cond_init(&context_object->picture_done, NULL);
+	memset(&context_object->params, 0, sizeof(context_object->params));
+	memset(&context_object->mpeg2, 0, sizeof(context_object->mpeg2));
 	memset(&context_object->dpb, 0, sizeof(context_object->dpb));
+	context_object->h264_slices = NULL;
+	context_object->h264_slices_size = 0;
+	context_object->h265_slices = NULL;
+	context_object->h265_slice_params = NULL;
+	context_object->h265_slices_size = 0;
+	context_object->h265_entry_points = NULL;
+	context_object->h265_entry_points_size = 0;
+	memset(&context_object->h265_dpb, 0, sizeof(context_object->h265_dpb));
+	context_object->h265_iqmatrix_valid = false;
+	context_object->h265_iqmatrix_pending = false;
+	memset(&context_object->vp9, 0, sizeof(context_object->vp9));
+#if VA_CHECK_VERSION(1, 8, 0)
+	memset(&context_object->av1_ref_map, 0,
+	       sizeof(context_object->av1_ref_map));
+#endif
 
 	switch (config_object->profile) {
 
@@ -104,13 +512,32 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 	case VAProfileH264ConstrainedBaseline:
 	case VAProfileH264MultiviewHigh:
 	case VAProfileH264StereoHigh:
+#if VA_CHECK_VERSION(1, 18, 0)
+	case VAProfileH264High10:
+#endif
 		pixelformat = V4L2_PIX_FMT_H264_SLICE;
 		break;
 
 	case VAProfileHEVCMain:
+	case VAProfileHEVCMain10:
 		pixelformat = V4L2_PIX_FMT_HEVC_SLICE;
 		break;
 
+	case VAProfileVP8Version0_3:
+		pixelformat = V4L2_PIX_FMT_VP8_FRAME;
+		break;
+
+	case VAProfileVP9Profile0:
+	case VAProfileVP9Profile2:
+		pixelformat = V4L2_PIX_FMT_VP9_FRAME;
+		break;
+
+#if VA_CHECK_VERSION(1, 8, 0)
+	case VAProfileAV1Profile0:
+		pixelformat = V4L2_PIX_FMT_AV1_FRAME;
+		break;
+#endif
+
 	default:
 		status = VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
 		goto error;
@@ -123,13 +550,75 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 		goto error;
 	}
 
+	/*
+	 * Slice-based H264 and HEVC decoders need one request per slice, so
+	 * find out once which mode we are dealing with.
+	 */
+	context_object->h264_slice_based = false;
+
+	if (pixelformat == V4L2_PIX_FMT_H264_SLICE) {
+		rc = v4l2_get_control(driver_data->video_fd,
+				      V4L2_CID_STATELESS_H264_DECODE_MODE,
+				      &decode_mode);
+		if (rc >= 0 &&
+		    decode_mode == V4L2_STATELESS_H264_DECODE_MODE_SLICE_BASED)
+			context_object->h264_slice_based = true;
+	}
+
+	context_object->h265_slice_based = false;
+
+	if (pixelformat == V4L2_PIX_FMT_HEVC_SLICE) {
+		rc = v4l2_get_control(driver_data->video_fd,
+				      V4L2_CID_STATELESS_HEVC_DECODE_MODE,
+				      &decode_mode);
+		if (rc >= 0 &&
+		    decode_mode == V4L2_STATELESS_HEVC_DECODE_MODE_SLICE_BASED)
+			context_object->h265_slice_based = true;
+	}
+
 	rc = v4l2_create_buffers(driver_data->video_fd, output_type,
-				 surfaces_count, &index_base);
+				 surfaces_count, 0, &index_base,
+				 &capabilities);
 	if (rc < 0) {
 		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
 		goto error;
 	}
 
+	context_object->hold_capture_supported =
+		capabilities & V4L2_BUF_CAP_SUPPORTS_M2M_HOLD_CAPTURE_BUF;
+
+	/*
+	 * Slices of a picture can only go to the same capture buffer when it
+	 * can be held, so fall back to frame-based decoding without it.
+	 */
+	if (!context_object->hold_capture_supported &&
+	    context_object->h264_slice_based) {
+		rc = v4l2_set_control_value(driver_data->video_fd,
+				V4L2_CID_STATELESS_H264_DECODE_MODE,
+				V4L2_STATELESS_H264_DECODE_MODE_FRAME_BASED);
+		if (rc < 0) {
+			request_log("Slice-based decoding needs capture buffer holding\n");
+			status = VA_STATUS_ERROR_OPERATION_FAILED;
+			goto error;
+		}
+
+		context_object->h264_slice_based = false;
+	}
+
+	if (!context_object->hold_capture_supported &&
+	    context_object->h265_slice_based) {
+		rc = v4l2_set_control_value(driver_data->video_fd,
+				V4L2_CID_STATELESS_HEVC_DECODE_MODE,
+				V4L2_STATELESS_HEVC_DECODE_MODE_FRAME_BASED);
+		if (rc < 0) {
+			request_log("Slice-based decoding needs capture buffer holding\n");
+			status = VA_STATUS_ERROR_OPERATION_FAILED;
+			goto error;
+		}
+
+		context_object->h265_slice_based = false;
+	}
+
 	/*
 	 * The surface_ids array has been allocated by the caller and
 	 * we don't have any indication wrt its life time. Let's make sure
@@ -169,6 +658,7 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 		surface_object->source_index = index;
 		surface_object->source_data = source_data;
 		surface_object->source_size = length;
+		surface_object->context_id = id;
 	}
 
 	rc = v4l2_set_stream(driver_data->video_fd, output_type, true);
@@ -185,6 +675,16 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 
 	context_object->config_id = config_id;
 	context_object->render_surface_id = VA_INVALID_ID;
+	context_object->source_size_peak = 0;
+	context_object->source_grow_count = 0;
+	memset(context_object->source_pool_count, 0,
+	       sizeof(context_object->source_pool_count));
+	context_object->slice_requests = NULL;
+	context_object->slice_requests_count = 0;
+	context_object->slice_requests_queued = 0;
+	context_object->sequence = 0;
+	memset(context_object->sequence_surfaces, 0xff,
+	       sizeof(context_object->sequence_surfaces));
 	context_object->surfaces_ids = ids;
 	context_object->surfaces_count = surfaces_count;
 	context_object->picture_width = picture_width;
@@ -203,9 +703,12 @@ error:
 	if (ids != NULL)
 		free(ids);
 
-	if (context_object != NULL)
+	if (context_object != NULL) {
+		pthread_cond_destroy(&context_object->picture_done);
+		pthread_mutex_destroy(&context_object->mutex);
 		object_heap_free(&driver_data->context_heap,
 				 (struct object_base *)context_object);
+	}
 
 complete:
 	return status;
@@ -214,9 +717,11 @@ complete:
 VAStatus RequestDestroyContext(VADriverContextP context, VAContextID context_id)
 {
 	struct request_data *driver_data = context->pDriverData;
+	struct context_slice_request *slice_request;
 	struct object_context *context_object;
 	struct video_format *video_format;
 	unsigned int output_type, capture_type;
+	unsigned int i, j;
 	VAStatus status;
 	int rc;
 
@@ -247,6 +752,30 @@ VAStatus RequestDestroyContext(VADriverContextP context, VAContextID context_id)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
 	free(context_object->surfaces_ids);
+	free(context_object->h264_slices);
+	free(context_object->h265_slices);
+	free(context_object->h265_slice_params);
+	free(context_object->h265_entry_points);
+
+	for (i = 0; i < context_object->slice_requests_count; i++) {
+		slice_request = &context_object->slice_requests[i];
+
+		if (slice_request->data != NULL)
+			munmap(slice_request->data, slice_request->size);
+
+		if (slice_request->request_fd >= 0)
+			close(slice_request->request_fd);
+	}
+
+	free(context_object->slice_requests);
+
+	for (i = 0; i < CONTEXT_SOURCE_CLASSES; i++)
+		for (j = 0; j < context_object->source_pool_count[i]; j++)
+			munmap(context_object->source_pool[i][j].data,
+			       context_object->source_pool[i][j].size);
+
+	pthread_cond_destroy(&context_object->picture_done);
+	pthread_mutex_destroy(&context_object->mutex);
 
 	object_heap_free(&driver_data->context_heap,
 			 (struct object_base *)context_object);
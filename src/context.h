@@ -27,31 +27,160 @@
 #ifndef _CONTEXT_H_
 #define _CONTEXT_H_
 
+#include <pthread.h>
+
 #include <va/va_backend.h>
 
 #include "object_heap.h"
+#include "av1.h"
 #include "h264.h"
+#include "h265.h"
+#include "mpeg2.h"
+#include "surface.h"
+#include "vp9.h"
 
 #define CONTEXT(data, id)                                                      \
 	((struct object_context *)object_heap_lookup(&(data)->context_heap, id))
 #define CONTEXT_ID_OFFSET		0x02000000
 
+#define CONTEXT_SEQUENCE_SURFACES	32
+
+/*
+ * OUTPUT buffer size classes, from SOURCE_SIZE_DEFAULT up to
+ * SOURCE_SIZE_LIMIT, and spare buffers kept per class (the OUTPUT queue
+ * holds at most 32 buffers).
+ */
+#define CONTEXT_SOURCE_CLASSES		7
+#define CONTEXT_SOURCE_POOL_SIZE	32
+
+struct request_data;
+
+/* OUTPUT buffer no longer attached to any surface, kept for reuse. */
+struct context_source_buffer {
+	unsigned int index;
+	void *data;
+	unsigned int size;
+};
+
+/* OUTPUT buffer and request of a slice queued on its own. */
+struct context_slice_request {
+	unsigned int index;
+	void *data;
+	unsigned int size;
+	unsigned int slice_size;
+	int request_fd;
+};
+
 struct object_context {
 	struct object_base base;
 
+	/*
+	 * Serializes the Begin/Render/EndPicture sequence and syncing the
+	 * surfaces of the context. Picture done is signalled when EndPicture
+	 * is over with the render surface.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t picture_done;
+
 	VAConfigID config_id;
 	VASurfaceID render_surface_id;
+	pthread_t render_thread;
 	VASurfaceID *surfaces_ids;
 	int surfaces_count;
 
+	/* Codec parameters of the picture being decoded. */
+	union surface_params params;
+
 	int picture_width;
 	int picture_height;
 	int flags;
 
+	/*
+	 * Pictures are stamped with a sequence number rather than the wall
+	 * clock. The last surfaces stamped can be found back from it.
+	 */
+	uint64_t sequence;
+	VASurfaceID sequence_surfaces[CONTEXT_SEQUENCE_SURFACES];
+
+	/* Largest bitstream seen so far and OUTPUT buffer growth count. */
+	unsigned int source_size_peak;
+	unsigned int source_grow_count;
+
+	/* Spare OUTPUT buffers left over by surfaces that grew, by size class. */
+	struct context_source_buffer
+		source_pool[CONTEXT_SOURCE_CLASSES][CONTEXT_SOURCE_POOL_SIZE];
+	unsigned int source_pool_count[CONTEXT_SOURCE_CLASSES];
+
+	/*
+	 * Slice-based decoding queues every slice of a picture but the first
+	 * one with a request of its own, waited for when the surface is synced.
+	 */
+	struct context_slice_request *slice_requests;
+	unsigned int slice_requests_count;
+	unsigned int slice_requests_queued;
+
+	/*
+	 * Whether the OUTPUT queue takes V4L2_BUF_FLAG_M2M_HOLD_CAPTURE_BUF.
+	 * Without it, the capture buffer of a first field is dequeued and
+	 * queued again for the second field.
+	 */
+	bool hold_capture_supported;
+
+	/* MPEG2 only */
+	struct mpeg2_header_state mpeg2;
+
 	/* H264 only */
 	struct h264_dpb dpb;
+	bool h264_slice_based;
+	/* Slice parameters of the picture, grown to fit any slice count. */
+	VASliceParameterBufferH264 *h264_slices;
+	unsigned int h264_slices_size;
+
+	/* H265 only */
+	struct h265_dpb h265_dpb;
+	VAIQMatrixBufferHEVC h265_iqmatrix;
+	bool h265_slice_based;
+	/*
+	 * Slice parameters and entry points of the picture, grown to fit any
+	 * count, along with room for the V4L2 slice parameters.
+	 */
+	VASliceParameterBufferHEVC *h265_slices;
+	struct v4l2_ctrl_hevc_slice_params *h265_slice_params;
+	unsigned int h265_slices_size;
+	uint32_t *h265_entry_points;
+	unsigned int h265_entry_points_size;
+	bool h265_iqmatrix_valid;
+	bool h265_iqmatrix_pending;
+
+	/* VP9 only */
+	struct vp9_header_state vp9;
+
+#if VA_CHECK_VERSION(1, 8, 0)
+	/* AV1 only */
+	struct av1_ref_map av1_ref_map;
+#endif
 };
 
+int context_reserve_source(struct request_data *driver_data,
+			   struct object_context *context_object,
+			   struct object_surface *surface_object,
+			   unsigned int size);
+struct context_slice_request *
+context_reserve_slice(struct request_data *driver_data,
+		      struct object_context *context_object,
+		      unsigned int slot, unsigned int size);
+int context_queue_slices(struct request_data *driver_data,
+			 struct object_context *context_object,
+			 struct object_surface *surface_object,
+			 unsigned int size, unsigned int count,
+			 bool hold_capture);
+int context_complete_slices(struct request_data *driver_data,
+			    struct object_context *context_object);
+void context_stamp_surface(struct object_context *context_object,
+			   struct object_surface *surface_object);
+struct object_surface *context_find_surface(struct request_data *driver_data,
+					    struct object_context *context_object,
+					    struct timeval *timestamp);
 VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 			      int picture_width, int picture_height, int flags,
 			      VASurfaceID *surfaces_ids, int surfaces_count,
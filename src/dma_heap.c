@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2026 libva-v4l2-request contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+
+#include "dma_heap.h"
+#include "utils.h"
+
+/*
+ * Prefer contiguous memory so that display engines without an IOMMU can
+ * scan out the buffers directly.
+ */
+static const char *dma_heap_paths[] = {
+	"/dev/dma_heap/linux,cma",
+	"/dev/dma_heap/reserved",
+	"/dev/dma_heap/system",
+};
+
+int dma_heap_open(const char *path)
+{
+	unsigned int i;
+	int fd;
+
+	if (path != NULL) {
+		fd = open(path, O_RDWR | O_CLOEXEC);
+		if (fd < 0)
+			request_log("Unable to open DMA heap %s: %s\n", path,
+				    strerror(errno));
+
+		return fd;
+	}
+
+	for (i = 0; i < sizeof(dma_heap_paths) / sizeof(dma_heap_paths[0]);
+	     i++) {
+		fd = open(dma_heap_paths[i], O_RDWR | O_CLOEXEC);
+		if (fd >= 0)
+			return fd;
+	}
+
+	request_log("Unable to find a DMA heap\n");
+
+	return -1;
+}
+
+int dma_heap_alloc(int heap_fd, unsigned int size)
+{
+	struct dma_heap_allocation_data data;
+	int rc;
+
+	memset(&data, 0, sizeof(data));
+	data.len = size;
+	data.fd_flags = O_RDWR | O_CLOEXEC;
+
+	rc = ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &data);
+	if (rc < 0) {
+		request_log("Unable to allocate DMA heap buffer: %s\n",
+			    strerror(errno));
+		return -1;
+	}
+
+	return data.fd;
+}
+
+int dma_buf_sync(int buf_fd, bool start)
+{
+	struct dma_buf_sync sync;
+	int rc;
+
+	memset(&sync, 0, sizeof(sync));
+	sync.flags = (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END) |
+		     DMA_BUF_SYNC_RW;
+
+	rc = ioctl(buf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+	if (rc < 0) {
+		request_log("Unable to sync DMA buffer: %s\n",
+			    strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
@@ -27,6 +27,7 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <sys/ioctl.h>
@@ -35,8 +36,10 @@
 #include <linux/videodev2.h>
 #include <h264-ctrls.h>
 
+#include "media.h"
 #include "request.h"
 #include "surface.h"
+#include "utils.h"
 #include "v4l2.h"
 
 enum h264_slice_type {
@@ -49,6 +52,38 @@ static bool is_picture_null(VAPictureH264 *pic)
 	return pic->picture_id == VA_INVALID_SURFACE;
 }
 
+static bool is_picture_field(VAPictureH264 *pic)
+{
+	unsigned int fields = pic->flags & (VA_PICTURE_H264_TOP_FIELD |
+					    VA_PICTURE_H264_BOTTOM_FIELD);
+
+	return fields == VA_PICTURE_H264_TOP_FIELD ||
+	       fields == VA_PICTURE_H264_BOTTOM_FIELD;
+}
+
+/* VA flags a single field when only that one is referenced. */
+static unsigned char h264_picture_fields(VAPictureH264 *pic)
+{
+	if (!is_picture_field(pic))
+		return V4L2_H264_FRAME_REF;
+
+	if (pic->flags & VA_PICTURE_H264_TOP_FIELD)
+		return V4L2_H264_TOP_FIELD_REF;
+
+	return V4L2_H264_BOTTOM_FIELD_REF;
+}
+
+static unsigned int dpb_map_index(VASurfaceID surface_id)
+{
+	return (surface_id & OBJECT_HEAP_ID_MASK) % H264_DPB_MAP_SIZE;
+}
+
+static unsigned int dpb_entry_index(struct object_context *context,
+				    struct h264_dpb_entry *entry)
+{
+	return entry - context->dpb.entries;
+}
+
 static struct h264_dpb_entry *
 dpb_find_invalid_entry(struct object_context *context)
 {
@@ -94,39 +129,78 @@ static struct h264_dpb_entry *dpb_find_entry(struct object_context *context)
 	return entry;
 }
 
+/*
+ * Entries are found through a map indexed by surface id. Surface ids of a
+ * context are allocated next to each other, so they do not collide in the
+ * map unless there are more surfaces than it has slots.
+ */
 static struct h264_dpb_entry *dpb_lookup(struct object_context *context,
 					 VAPictureH264 *pic, unsigned int *idx)
 {
-	unsigned int i;
+	struct h264_dpb_entry *entry;
+	unsigned int slot;
 
-	for (i = 0; i < H264_DPB_SIZE; i++) {
-		struct h264_dpb_entry *entry = &context->dpb.entries[i];
+	slot = context->dpb.map[dpb_map_index(pic->picture_id)];
+	if (slot == 0)
+		return NULL;
 
-		if (!entry->valid)
-			continue;
+	entry = &context->dpb.entries[slot - 1];
+	if (!entry->valid || entry->pic.picture_id != pic->picture_id)
+		return NULL;
 
-		if (entry->pic.picture_id == pic->picture_id) {
-			if (idx)
-				*idx = i;
+	if (idx)
+		*idx = slot - 1;
 
-			return entry;
-		}
-	}
+	return entry;
+}
 
-	return NULL;
+/* Keep the V4L2 view of an entry in sync with its picture. */
+static void dpb_sync_entry(struct object_context *context,
+			   struct h264_dpb_entry *entry)
+{
+	struct v4l2_h264_dpb_entry *dpb =
+		&context->dpb.v4l2_entries[dpb_entry_index(context, entry)];
+
+	dpb->reference_ts = entry->timestamp;
+	dpb->frame_num = entry->pic.frame_idx;
+	dpb->fields = h264_picture_fields(&entry->pic);
+	dpb->top_field_order_cnt = entry->pic.TopFieldOrderCnt;
+	dpb->bottom_field_order_cnt = entry->pic.BottomFieldOrderCnt;
+
+	dpb->flags = V4L2_H264_DPB_ENTRY_FLAG_VALID;
+
+	if (entry->used)
+		dpb->flags |= V4L2_H264_DPB_ENTRY_FLAG_ACTIVE;
+
+	if (entry->pic.flags & VA_PICTURE_H264_LONG_TERM_REFERENCE)
+		dpb->flags |= V4L2_H264_DPB_ENTRY_FLAG_LONG_TERM;
 }
 
-static void dpb_clear_entry(struct h264_dpb_entry *entry, bool reserved)
+static void dpb_clear_entry(struct object_context *context,
+			    struct h264_dpb_entry *entry, bool reserved)
 {
+	unsigned int index = dpb_entry_index(context, entry);
+	unsigned char *slot;
+
+	if (entry->valid) {
+		slot = &context->dpb.map[dpb_map_index(entry->pic.picture_id)];
+		if (*slot == index + 1)
+			*slot = 0;
+	}
+
 	memset(entry, 0, sizeof(*entry));
+	memset(&context->dpb.v4l2_entries[index], 0,
+	       sizeof(context->dpb.v4l2_entries[index]));
 
 	if (reserved)
 		entry->reserved = true;
 }
 
 static void dpb_insert(struct object_context *context, VAPictureH264 *pic,
-		       struct h264_dpb_entry *entry)
+		       struct h264_dpb_entry *entry, uint64_t timestamp)
 {
+	unsigned char *slot;
+
 	if (is_picture_null(pic))
 		return;
 
@@ -136,18 +210,35 @@ static void dpb_insert(struct object_context *context, VAPictureH264 *pic,
 	if (!entry)
 		entry = dpb_find_entry(context);
 
+	if (entry->valid)
+		dpb_clear_entry(context, entry, false);
+
+	/* Drop whatever picture collides with this one in the map. */
+	slot = &context->dpb.map[dpb_map_index(pic->picture_id)];
+	if (*slot != 0 && *slot != dpb_entry_index(context, entry) + 1)
+		dpb_clear_entry(context, &context->dpb.entries[*slot - 1],
+				false);
+
 	memcpy(&entry->pic, pic, sizeof(entry->pic));
+	entry->timestamp = timestamp;
 	entry->age = context->dpb.age;
 	entry->valid = true;
 	entry->reserved = false;
 
 	if (!(pic->flags & VA_PICTURE_H264_INVALID))
 		entry->used = true;
+
+	*slot = dpb_entry_index(context, entry) + 1;
+
+	dpb_sync_entry(context, entry);
 }
 
-static void dpb_update(struct object_context *context,
+static void dpb_update(struct request_data *driver_data,
+		       struct object_context *context,
 		       VAPictureParameterBufferH264 *parameters)
 {
+	struct object_surface *surface;
+	uint64_t timestamp;
 	unsigned int i;
 
 	context->dpb.age++;
@@ -156,6 +247,8 @@ static void dpb_update(struct object_context *context,
 		struct h264_dpb_entry *entry = &context->dpb.entries[i];
 
 		entry->used = false;
+		context->dpb.v4l2_entries[i].flags &=
+			~V4L2_H264_DPB_ENTRY_FLAG_ACTIVE;
 	}
 
 	for (i = 0; i < parameters->num_ref_frames; i++) {
@@ -167,47 +260,38 @@ static void dpb_update(struct object_context *context,
 
 		entry = dpb_lookup(context, pic, NULL);
 		if (entry) {
+			/* Refresh the field and long-term marking. */
+			memcpy(&entry->pic, pic, sizeof(entry->pic));
 			entry->age = context->dpb.age;
 			entry->used = true;
+			dpb_sync_entry(context, entry);
 		} else {
-			dpb_insert(context, pic, NULL);
+			/* Only references we did not decode need a lookup. */
+			surface = SURFACE(driver_data, pic->picture_id);
+			timestamp = surface != NULL ?
+				v4l2_timeval_to_ns(&surface->timestamp) : 0;
+
+			dpb_insert(context, pic, NULL, timestamp);
 		}
 	}
 }
 
 static void h264_fill_dpb(struct request_data *data,
 			  struct object_context *context,
+			  VAPictureParameterBufferH264 *VAPicture,
 			  struct v4l2_ctrl_h264_decode_params *decode)
 {
-	int i;
-
-	for (i = 0; i < H264_DPB_SIZE; i++) {
-		struct v4l2_h264_dpb_entry *dpb = &decode->dpb[i];
-		struct h264_dpb_entry *entry = &context->dpb.entries[i];
-		struct object_surface *surface =
-			SURFACE(data, entry->pic.picture_id);
-		uint64_t timestamp;
-
-		if (!entry->valid)
-			continue;
-
-		if (surface) {
-			timestamp = v4l2_timeval_to_ns(&surface->timestamp);
-			dpb->reference_ts = timestamp;
-		}
-
-		dpb->frame_num = entry->pic.frame_idx;
-		dpb->top_field_order_cnt = entry->pic.TopFieldOrderCnt;
-		dpb->bottom_field_order_cnt = entry->pic.BottomFieldOrderCnt;
-
-		dpb->flags = V4L2_H264_DPB_ENTRY_FLAG_VALID;
+	unsigned int i;
 
-		if (entry->used)
-			dpb->flags |= V4L2_H264_DPB_ENTRY_FLAG_ACTIVE;
+	memcpy(decode->dpb, context->dpb.v4l2_entries,
+	       sizeof(context->dpb.v4l2_entries));
 
-		if (entry->pic.flags & VA_PICTURE_H264_LONG_TERM_REFERENCE)
-			dpb->flags |= V4L2_H264_DPB_ENTRY_FLAG_LONG_TERM;
-	}
+	/* References are fields when decoding a field picture. */
+	if (is_picture_field(&VAPicture->CurrPic))
+		for (i = 0; i < H264_DPB_SIZE; i++)
+			if (decode->dpb[i].flags & V4L2_H264_DPB_ENTRY_FLAG_VALID)
+				decode->dpb[i].flags |=
+					V4L2_H264_DPB_ENTRY_FLAG_FIELD;
 }
 
 static void h264_va_picture_to_v4l2(struct request_data *driver_data,
@@ -218,11 +302,20 @@ static void h264_va_picture_to_v4l2(struct request_data *driver_data,
 				    struct v4l2_ctrl_h264_pps *pps,
 				    struct v4l2_ctrl_h264_sps *sps)
 {
-	h264_fill_dpb(driver_data, context, decode);
+	h264_fill_dpb(driver_data, context, VAPicture, decode);
 
+	decode->frame_num = VAPicture->frame_num;
+	decode->nal_ref_idc = VAPicture->pic_fields.bits.reference_pic_flag;
 	decode->top_field_order_cnt = VAPicture->CurrPic.TopFieldOrderCnt;
 	decode->bottom_field_order_cnt = VAPicture->CurrPic.BottomFieldOrderCnt;
 
+	if (is_picture_field(&VAPicture->CurrPic)) {
+		decode->flags |= V4L2_H264_DECODE_PARAM_FLAG_FIELD_PIC;
+
+		if (VAPicture->CurrPic.flags & VA_PICTURE_H264_BOTTOM_FIELD)
+			decode->flags |= V4L2_H264_DECODE_PARAM_FLAG_BOTTOM_FIELD;
+	}
+
 	pps->weighted_bipred_idc =
 		VAPicture->pic_fields.bits.weighted_bipred_idc;
 	pps->pic_init_qs_minus26 = VAPicture->pic_init_qs_minus26;
@@ -355,7 +448,7 @@ static void h264_va_slice_to_v4l2(struct request_data *driver_data,
 				continue;
 
 			slice->ref_pic_list0[i].index = idx;
-			slice->ref_pic_list0[i].fields = 0;
+			slice->ref_pic_list0[i].fields = h264_picture_fields(pic);
 		}
 	}
 
@@ -375,7 +468,7 @@ static void h264_va_slice_to_v4l2(struct request_data *driver_data,
 				continue;
 
 			slice->ref_pic_list1[i].index = idx;
-			slice->ref_pic_list1[i].fields = 0;
+			slice->ref_pic_list1[i].fields = h264_picture_fields(pic);
 		}
 	}
 
@@ -383,6 +476,47 @@ static void h264_va_slice_to_v4l2(struct request_data *driver_data,
 		slice->flags |= V4L2_H264_SLICE_FLAG_DIRECT_SPATIAL_MV_PRED;
 }
 
+/*
+ * Pictures may come with any number of slices, so the array is grown to fit
+ * and kept for the following pictures of the context.
+ */
+VAStatus h264_store_slice_params(struct object_context *context,
+				 struct object_surface *surface,
+				 VASliceParameterBufferH264 *slices,
+				 unsigned int count)
+{
+	VASliceParameterBufferH264 *slice;
+	unsigned int slices_count = surface->params->h264.slices_count;
+	unsigned int size;
+	unsigned int i;
+
+	if (slices_count + count > context->h264_slices_size) {
+		size = context->h264_slices_size > 0 ?
+		       context->h264_slices_size : H264_SLICES_DEFAULT;
+		while (size < slices_count + count)
+			size *= 2;
+
+		slice = realloc(context->h264_slices, size * sizeof(*slice));
+		if (slice == NULL)
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+		context->h264_slices = slice;
+		context->h264_slices_size = size;
+	}
+
+	for (i = 0; i < count; i++) {
+		slice = &context->h264_slices[
+			surface->params->h264.slices_count++];
+
+		memcpy(slice, &slices[i], sizeof(*slice));
+
+		/* Make the offset relative to the start of the source data. */
+		slice->slice_data_offset += surface->slices_size;
+	}
+
+	return VA_STATUS_SUCCESS;
+}
+
 int h264_set_controls(struct request_data *driver_data,
 		      struct object_context *context,
 		      struct object_surface *surface)
@@ -392,26 +526,39 @@ int h264_set_controls(struct request_data *driver_data,
 	struct v4l2_ctrl_h264_slice_params slice = { 0 };
 	struct v4l2_ctrl_h264_pps pps = { 0 };
 	struct v4l2_ctrl_h264_sps sps = { 0 };
+	VAPictureH264 *pic = &surface->params->h264.picture.CurrPic;
 	struct h264_dpb_entry *output;
+	bool second_field;
 	int rc;
 
-	output = dpb_lookup(context, &surface->params.h264.picture.CurrPic,
-			    NULL);
+	/*
+	 * The second field of a pair goes to the capture buffer held since
+	 * the first one, which stays in the DPB as a reference candidate.
+	 */
+	second_field = surface->capture_held && is_picture_field(pic);
+
+	output = dpb_lookup(context, pic, NULL);
 	if (!output)
 		output = dpb_find_entry(context);
 
-	dpb_clear_entry(output, true);
+	if (!second_field)
+		dpb_clear_entry(context, output, true);
 
-	dpb_update(context, &surface->params.h264.picture);
+	dpb_update(driver_data, context, &surface->params->h264.picture);
 
 	h264_va_picture_to_v4l2(driver_data, context, surface,
-				&surface->params.h264.picture,
+				&surface->params->h264.picture,
 				&decode, &pps, &sps);
 	h264_va_matrix_to_v4l2(driver_data, context,
-			       &surface->params.h264.matrix, &matrix);
-	h264_va_slice_to_v4l2(driver_data, context,
-			      &surface->params.h264.slice,
-			      &surface->params.h264.picture, &slice);
+			       &surface->params->h264.matrix, &matrix);
+	/*
+	 * Frame-based decoders ignore the slice parameters while slice-based
+	 * ones get the first slice here and the others in h264_queue_slices.
+	 */
+	if (surface->params->h264.slices_count > 0)
+		h264_va_slice_to_v4l2(driver_data, context,
+				      &context->h264_slices[0],
+				      &surface->params->h264.picture, &slice);
 
 	rc = v4l2_set_control(driver_data->video_fd, surface->request_fd,
 			      V4L2_CID_STATELESS_H264_DECODE_PARAMS, &decode,
@@ -441,7 +588,82 @@ int h264_set_controls(struct request_data *driver_data,
 	if (rc < 0)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
-	dpb_insert(context, &surface->params.h264.picture.CurrPic, output);
+	dpb_insert(context, pic, output,
+		   v4l2_timeval_to_ns(&surface->timestamp));
 
 	return VA_STATUS_SUCCESS;
 }
+
+bool h264_is_first_field(struct object_surface *surface)
+{
+	return is_picture_field(&surface->params->h264.picture.CurrPic) &&
+	       !surface->capture_held;
+}
+
+/*
+ * Slice-based decoders take one slice per request. The first slice goes with
+ * the request of the surface, which carries the picture controls, and every
+ * other one is copied to a slice request of its own, so that all of them can
+ * be queued back to back.
+ */
+int h264_queue_slices(struct request_data *driver_data,
+		      struct object_context *context,
+		      struct object_surface *surface, bool hold_capture)
+{
+	struct context_slice_request *slice_request;
+	struct v4l2_ctrl_h264_slice_params slice;
+	VASliceParameterBufferH264 *va_slice;
+	unsigned int slices_count = surface->params->h264.slices_count;
+	unsigned int end = 0;
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < slices_count; i++) {
+		va_slice = &context->h264_slices[i];
+
+		if (va_slice->slice_data_offset < end ||
+		    va_slice->slice_data_offset + va_slice->slice_data_size >
+			    surface->slices_size) {
+			request_log("Invalid H264 slice %u data range\n", i);
+			return -1;
+		}
+
+		end = va_slice->slice_data_offset + va_slice->slice_data_size;
+
+		if (i == 0)
+			continue;
+
+		slice_request = context_reserve_slice(driver_data, context,
+						      i - 1,
+						      va_slice->slice_data_size);
+		if (slice_request == NULL)
+			return -1;
+
+		memcpy(slice_request->data,
+		       surface->source_data + va_slice->slice_data_offset,
+		       va_slice->slice_data_size);
+		slice_request->slice_size = va_slice->slice_data_size;
+
+		memset(&slice, 0, sizeof(slice));
+		h264_va_slice_to_v4l2(driver_data, context, va_slice,
+				      &surface->params->h264.picture, &slice);
+
+		rc = v4l2_set_control(driver_data->video_fd,
+				      slice_request->request_fd,
+				      V4L2_CID_STATELESS_H264_SLICE_PARAMS,
+				      &slice, sizeof(slice));
+		if (rc < 0)
+			return -1;
+	}
+
+	/* The other slices were copied out, the first one can move. */
+	va_slice = &context->h264_slices[0];
+	if (va_slice->slice_data_offset > 0)
+		memmove(surface->source_data,
+			surface->source_data + va_slice->slice_data_offset,
+			va_slice->slice_data_size);
+
+	return context_queue_slices(driver_data, context, surface,
+				    va_slice->slice_data_size,
+				    slices_count - 1, hold_capture);
+}
@@ -29,6 +29,9 @@
 #define _H264_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#include <linux/videodev2.h>
 
 #include <va/va.h>
 
@@ -37,9 +40,12 @@ struct object_surface;
 struct request_data;
 
 #define H264_DPB_SIZE 16
+#define H264_DPB_MAP_SIZE 256
+#define H264_SLICES_DEFAULT 32
 
 struct h264_dpb_entry {
 	VAPictureH264 pic;
+	uint64_t timestamp;
 	unsigned int age;
 	bool used;
 	bool valid;
@@ -48,11 +54,23 @@ struct h264_dpb_entry {
 
 struct h264_dpb {
 	struct h264_dpb_entry entries[H264_DPB_SIZE];
+	/* Decode parameters view of the entries, updated along with them. */
+	struct v4l2_h264_dpb_entry v4l2_entries[H264_DPB_SIZE];
+	/* Entry index plus one, indexed by surface id. */
+	unsigned char map[H264_DPB_MAP_SIZE];
 	unsigned int age;
 };
 
+VAStatus h264_store_slice_params(struct object_context *context,
+				 struct object_surface *surface,
+				 VASliceParameterBufferH264 *slices,
+				 unsigned int count);
 int h264_set_controls(struct request_data *data,
 		      struct object_context *context,
 		      struct object_surface *surface);
+bool h264_is_first_field(struct object_surface *surface);
+int h264_queue_slices(struct request_data *data,
+		      struct object_context *context,
+		      struct object_surface *surface, bool hold_capture);
 
 #endif
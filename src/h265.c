@@ -24,12 +24,13 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#include "mpeg2.h"
+#include "h265.h"
 #include "context.h"
 #include "request.h"
 #include "surface.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <sys/ioctl.h>
@@ -38,21 +39,202 @@
 #include <linux/videodev2.h>
 #include <hevc-ctrls.h>
 
+#include "nal.h"
+#include "utils.h"
 #include "v4l2.h"
 
 #define H265_NAL_UNIT_TYPE_SHIFT		1
 #define H265_NAL_UNIT_TYPE_MASK			((1 << 6) - 1)
 #define H265_NUH_TEMPORAL_ID_PLUS1_SHIFT	0
 #define H265_NUH_TEMPORAL_ID_PLUS1_MASK		((1 << 3) - 1)
+#define H265_NAL_UNIT_TYPE_VCL_MAX		32
+
+static bool h265_picture_is_null(VAPictureHEVC *pic)
+{
+	return pic->picture_id == VA_INVALID_SURFACE ||
+	       (pic->flags & VA_PICTURE_HEVC_INVALID);
+}
+
+static struct h265_dpb_entry *h265_dpb_lookup(struct object_context *context,
+					      VASurfaceID surface_id)
+{
+	unsigned int i;
+
+	for (i = 0; i < H265_DPB_SIZE; i++) {
+		struct h265_dpb_entry *entry = &context->h265_dpb.entries[i];
+
+		if (entry->valid && entry->pic.picture_id == surface_id)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Entries that are not referenced by the current picture go first, then the
+ * one that was decoded the longest time ago.
+ */
+static struct h265_dpb_entry *
+h265_dpb_find_victim(struct object_context *context)
+{
+	struct h265_dpb_entry *match = NULL;
+	struct h265_dpb_entry *entry;
+	unsigned int i;
+
+	for (i = 0; i < H265_DPB_SIZE; i++) {
+		entry = &context->h265_dpb.entries[i];
+
+		if (match == NULL || (match->used && !entry->used) ||
+		    (match->used == entry->used &&
+		     entry->timestamp < match->timestamp))
+			match = entry;
+	}
+
+	return match;
+}
+
+static struct h265_dpb_entry *h265_dpb_insert(struct request_data *driver_data,
+					      struct object_context *context,
+					      VAPictureHEVC *pic)
+{
+	struct object_surface *surface_object;
+	struct h265_dpb_entry *entry;
+	unsigned int i;
+
+	entry = h265_dpb_lookup(context, pic->picture_id);
+	if (entry == NULL) {
+		for (i = 0; i < H265_DPB_SIZE; i++) {
+			if (!context->h265_dpb.entries[i].valid) {
+				entry = &context->h265_dpb.entries[i];
+				break;
+			}
+		}
+	}
+
+	if (entry == NULL) {
+		entry = h265_dpb_find_victim(context);
+
+		request_log("HEVC DPB full, evicting surface %#x\n",
+			    entry->pic.picture_id);
+	}
+
+	surface_object = SURFACE(driver_data, pic->picture_id);
+
+	memcpy(&entry->pic, pic, sizeof(entry->pic));
+	entry->timestamp = surface_object != NULL ?
+		v4l2_timeval_to_ns(&surface_object->timestamp) : 0;
+	entry->used = true;
+	entry->valid = true;
+
+	return entry;
+}
+
+/*
+ * The timestamp of each reference is recorded when it gets decoded, so that
+ * references stay attached to the capture buffer holding them no matter what
+ * happens to the surface timestamp in other in-flight requests. Pictures that
+ * are no longer referenced are dropped.
+ */
+static void h265_dpb_update(struct request_data *driver_data,
+			    struct object_context *context,
+			    VAPictureParameterBufferHEVC *picture)
+{
+	struct h265_dpb_entry *entry;
+	unsigned int i;
+
+	for (i = 0; i < H265_DPB_SIZE; i++)
+		context->h265_dpb.entries[i].used = false;
+
+	for (i = 0; i < H265_DPB_SIZE - 1; i++) {
+		VAPictureHEVC *pic = &picture->ReferenceFrames[i];
+
+		if (h265_picture_is_null(pic))
+			continue;
+
+		entry = h265_dpb_lookup(context, pic->picture_id);
+		if (entry != NULL) {
+			/* Long-term marking and POC may change over time. */
+			memcpy(&entry->pic, pic, sizeof(entry->pic));
+			entry->used = true;
+		} else {
+			h265_dpb_insert(driver_data, context, pic);
+		}
+	}
+
+	for (i = 0; i < H265_DPB_SIZE; i++) {
+		entry = &context->h265_dpb.entries[i];
+
+		if (!entry->used)
+			entry->valid = false;
+	}
+}
+
+static void h265_fill_decode_params(struct object_context *context,
+				    VAPictureParameterBufferHEVC *picture,
+				    struct v4l2_ctrl_hevc_decode_params *decode,
+				    uint8_t *ref_map)
+{
+	struct v4l2_hevc_dpb_entry *dpb;
+	struct h265_dpb_entry *entry;
+	unsigned int index;
+	unsigned int i;
+
+	memset(decode, 0, sizeof(*decode));
+	memset(ref_map, 0xff, H265_DPB_SIZE - 1);
+
+	decode->pic_order_cnt_val = picture->CurrPic.pic_order_cnt;
+	decode->short_term_ref_pic_set_size = picture->st_rps_bits;
+
+	for (i = 0; i < H265_DPB_SIZE - 1; i++) {
+		VAPictureHEVC *pic = &picture->ReferenceFrames[i];
+
+		if (h265_picture_is_null(pic))
+			continue;
+
+		entry = h265_dpb_lookup(context, pic->picture_id);
+		if (entry == NULL)
+			continue;
+
+		index = decode->num_active_dpb_entries++;
+		ref_map[i] = index;
+
+		dpb = &decode->dpb[index];
+		dpb->timestamp = entry->timestamp;
+		dpb->pic_order_cnt_val = pic->pic_order_cnt;
+		dpb->field_pic = !!(pic->flags & VA_PICTURE_HEVC_FIELD_PIC);
+
+		if (pic->flags & VA_PICTURE_HEVC_LONG_TERM_REFERENCE)
+			dpb->flags |= V4L2_HEVC_DPB_ENTRY_LONG_TERM_REFERENCE;
+
+		if (pic->flags & VA_PICTURE_HEVC_RPS_ST_CURR_BEFORE)
+			decode->poc_st_curr_before[
+				decode->num_poc_st_curr_before++] = index;
+		else if (pic->flags & VA_PICTURE_HEVC_RPS_ST_CURR_AFTER)
+			decode->poc_st_curr_after[
+				decode->num_poc_st_curr_after++] = index;
+		else if (pic->flags & VA_PICTURE_HEVC_RPS_LT_CURR)
+			decode->poc_lt_curr[decode->num_poc_lt_curr++] = index;
+	}
+
+	if (picture->slice_parsing_fields.bits.RapPicFlag)
+		decode->flags |= V4L2_HEVC_DECODE_PARAM_FLAG_IRAP_PIC;
+
+	if (picture->slice_parsing_fields.bits.IdrPicFlag)
+		decode->flags |= V4L2_HEVC_DECODE_PARAM_FLAG_IDR_PIC;
+}
 
 static void h265_fill_pps(VAPictureParameterBufferHEVC *picture,
-			  VASliceParameterBufferHEVC *slice,
 			  struct v4l2_ctrl_hevc_pps *pps)
 {
+	unsigned int i;
+
 	memset(pps, 0, sizeof(*pps));
 
-	// Only assign fields that exist in the struct.
 	pps->num_extra_slice_header_bits = picture->num_extra_slice_header_bits;
+	pps->num_ref_idx_l0_default_active_minus1 =
+		picture->num_ref_idx_l0_default_active_minus1;
+	pps->num_ref_idx_l1_default_active_minus1 =
+		picture->num_ref_idx_l1_default_active_minus1;
 	pps->init_qp_minus26 = picture->init_qp_minus26;
 	pps->diff_cu_qp_delta_depth = picture->diff_cu_qp_delta_depth;
 	pps->pps_cb_qp_offset = picture->pps_cb_qp_offset;
@@ -61,11 +243,94 @@ static void h265_fill_pps(VAPictureParameterBufferHEVC *picture,
 	pps->num_tile_rows_minus1 = picture->num_tile_rows_minus1;
 	pps->pps_beta_offset_div2 = picture->pps_beta_offset_div2;
 	pps->pps_tc_offset_div2 = picture->pps_tc_offset_div2;
-	pps->log2_parallel_merge_level_minus2 = picture->log2_parallel_merge_level_minus2;
+	pps->log2_parallel_merge_level_minus2 =
+		picture->log2_parallel_merge_level_minus2;
+
+	/*
+	 * VA always gives explicit tile sizes, computed by the client when
+	 * uniform_spacing_flag is set, so the flag is left clear.
+	 */
+	if (picture->pic_fields.bits.tiles_enabled_flag) {
+		for (i = 0; i <= picture->num_tile_columns_minus1 &&
+			    i < sizeof(picture->column_width_minus1) /
+				    sizeof(picture->column_width_minus1[0]); i++)
+			pps->column_width_minus1[i] =
+				picture->column_width_minus1[i];
 
-	// If you need to set flags (e.g. constrained_intra_pred_flag), set pps->flags with appropriate bitmask.
-	pps->flags = 0;
-	// Example: if you want to set a specific flag, use the bitmask provided by the kernel headers (if any).
+		for (i = 0; i <= picture->num_tile_rows_minus1 &&
+			    i < sizeof(picture->row_height_minus1) /
+				    sizeof(picture->row_height_minus1[0]); i++)
+			pps->row_height_minus1[i] =
+				picture->row_height_minus1[i];
+	}
+
+	if (picture->slice_parsing_fields.bits.dependent_slice_segments_enabled_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_DEPENDENT_SLICE_SEGMENT_ENABLED;
+
+	if (picture->slice_parsing_fields.bits.output_flag_present_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_OUTPUT_FLAG_PRESENT;
+
+	if (picture->pic_fields.bits.sign_data_hiding_enabled_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_SIGN_DATA_HIDING_ENABLED;
+
+	if (picture->slice_parsing_fields.bits.cabac_init_present_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_CABAC_INIT_PRESENT;
+
+	if (picture->pic_fields.bits.constrained_intra_pred_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_CONSTRAINED_INTRA_PRED;
+
+	if (picture->pic_fields.bits.transform_skip_enabled_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_TRANSFORM_SKIP_ENABLED;
+
+	if (picture->pic_fields.bits.cu_qp_delta_enabled_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_CU_QP_DELTA_ENABLED;
+
+	if (picture->slice_parsing_fields.bits.pps_slice_chroma_qp_offsets_present_flag)
+		pps->flags |=
+			V4L2_HEVC_PPS_FLAG_PPS_SLICE_CHROMA_QP_OFFSETS_PRESENT;
+
+	if (picture->pic_fields.bits.weighted_pred_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_WEIGHTED_PRED;
+
+	if (picture->pic_fields.bits.weighted_bipred_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_WEIGHTED_BIPRED;
+
+	if (picture->pic_fields.bits.transquant_bypass_enabled_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_TRANSQUANT_BYPASS_ENABLED;
+
+	if (picture->pic_fields.bits.tiles_enabled_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_TILES_ENABLED;
+
+	if (picture->pic_fields.bits.entropy_coding_sync_enabled_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_ENTROPY_CODING_SYNC_ENABLED;
+
+	if (picture->pic_fields.bits.loop_filter_across_tiles_enabled_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_LOOP_FILTER_ACROSS_TILES_ENABLED;
+
+	if (picture->pic_fields.bits.pps_loop_filter_across_slices_enabled_flag)
+		pps->flags |=
+			V4L2_HEVC_PPS_FLAG_PPS_LOOP_FILTER_ACROSS_SLICES_ENABLED;
+
+	if (picture->slice_parsing_fields.bits.deblocking_filter_override_enabled_flag)
+		pps->flags |=
+			V4L2_HEVC_PPS_FLAG_DEBLOCKING_FILTER_OVERRIDE_ENABLED;
+
+	if (picture->slice_parsing_fields.bits.pps_disable_deblocking_filter_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_PPS_DISABLE_DEBLOCKING_FILTER;
+
+	if (picture->slice_parsing_fields.bits.lists_modification_present_flag)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_LISTS_MODIFICATION_PRESENT;
+
+	if (picture->slice_parsing_fields.bits.slice_segment_header_extension_present_flag)
+		pps->flags |=
+			V4L2_HEVC_PPS_FLAG_SLICE_SEGMENT_HEADER_EXTENSION_PRESENT;
+
+	/* VA does not carry deblocking_filter_control_present_flag. */
+	if (pps->flags & (V4L2_HEVC_PPS_FLAG_DEBLOCKING_FILTER_OVERRIDE_ENABLED |
+			  V4L2_HEVC_PPS_FLAG_PPS_DISABLE_DEBLOCKING_FILTER) ||
+	    picture->pps_beta_offset_div2 != 0 ||
+	    picture->pps_tc_offset_div2 != 0)
+		pps->flags |= V4L2_HEVC_PPS_FLAG_DEBLOCKING_FILTER_CONTROL_PRESENT;
 }
 
 static void h265_fill_sps(VAPictureParameterBufferHEVC *picture,
@@ -79,7 +344,7 @@ static void h265_fill_sps(VAPictureParameterBufferHEVC *picture,
 	sps->bit_depth_chroma_minus8 = picture->bit_depth_chroma_minus8;
 	sps->log2_max_pic_order_cnt_lsb_minus4 = picture->log2_max_pic_order_cnt_lsb_minus4;
 	sps->sps_max_dec_pic_buffering_minus1 = picture->sps_max_dec_pic_buffering_minus1;
-	// The following are not always directly available; set 0 if unsure or map from your picture struct if you have the value.
+	/* VA carries neither the reorder nor the latency limits. */
 	sps->sps_max_num_reorder_pics = 0;
 	sps->sps_max_latency_increase_plus1 = 0;
 	sps->log2_min_luma_coding_block_size_minus3 = picture->log2_min_luma_coding_block_size_minus3;
@@ -96,32 +361,211 @@ static void h265_fill_sps(VAPictureParameterBufferHEVC *picture,
 	sps->num_long_term_ref_pics_sps = picture->num_long_term_ref_pic_sps;
 	sps->chroma_format_idc = picture->pic_fields.bits.chroma_format_idc;
 	sps->sps_max_sub_layers_minus1 = 0;
-	memset(sps->reserved, 0, sizeof(sps->reserved));
-	sps->flags = 0;
+
+	if (picture->pic_fields.bits.separate_colour_plane_flag)
+		sps->flags |= V4L2_HEVC_SPS_FLAG_SEPARATE_COLOUR_PLANE;
+
+	if (picture->pic_fields.bits.scaling_list_enabled_flag)
+		sps->flags |= V4L2_HEVC_SPS_FLAG_SCALING_LIST_ENABLED;
+
+	if (picture->pic_fields.bits.amp_enabled_flag)
+		sps->flags |= V4L2_HEVC_SPS_FLAG_AMP_ENABLED;
+
+	if (picture->slice_parsing_fields.bits.sample_adaptive_offset_enabled_flag)
+		sps->flags |= V4L2_HEVC_SPS_FLAG_SAMPLE_ADAPTIVE_OFFSET;
+
+	if (picture->pic_fields.bits.pcm_enabled_flag)
+		sps->flags |= V4L2_HEVC_SPS_FLAG_PCM_ENABLED;
+
+	if (picture->pic_fields.bits.pcm_loop_filter_disabled_flag)
+		sps->flags |= V4L2_HEVC_SPS_FLAG_PCM_LOOP_FILTER_DISABLED;
+
+	if (picture->slice_parsing_fields.bits.long_term_ref_pics_present_flag)
+		sps->flags |= V4L2_HEVC_SPS_FLAG_LONG_TERM_REF_PICS_PRESENT;
+
+	if (picture->slice_parsing_fields.bits.sps_temporal_mvp_enabled_flag)
+		sps->flags |= V4L2_HEVC_SPS_FLAG_SPS_TEMPORAL_MVP_ENABLED;
+
+	if (picture->pic_fields.bits.strong_intra_smoothing_enabled_flag)
+		sps->flags |= V4L2_HEVC_SPS_FLAG_STRONG_INTRA_SMOOTHING_ENABLED;
+}
+
+static void h265_fill_scaling_matrix(VAIQMatrixBufferHEVC *iqmatrix,
+				     struct v4l2_ctrl_hevc_scaling_matrix *matrix)
+{
+	/* Both sides use raster scan order and the same list layout. */
+	memcpy(matrix->scaling_list_4x4, iqmatrix->ScalingList4x4,
+	       sizeof(matrix->scaling_list_4x4));
+	memcpy(matrix->scaling_list_8x8, iqmatrix->ScalingList8x8,
+	       sizeof(matrix->scaling_list_8x8));
+	memcpy(matrix->scaling_list_16x16, iqmatrix->ScalingList16x16,
+	       sizeof(matrix->scaling_list_16x16));
+	memcpy(matrix->scaling_list_32x32, iqmatrix->ScalingList32x32,
+	       sizeof(matrix->scaling_list_32x32));
+	memcpy(matrix->scaling_list_dc_coef_16x16,
+	       iqmatrix->ScalingListDC16x16,
+	       sizeof(matrix->scaling_list_dc_coef_16x16));
+	memcpy(matrix->scaling_list_dc_coef_32x32,
+	       iqmatrix->ScalingListDC32x32,
+	       sizeof(matrix->scaling_list_dc_coef_32x32));
+}
+
+/*
+ * Scaling lists rarely change within a stream. Controls that are not part of
+ * a request keep their current value, so the matrix is only converted and
+ * sent again when the one given by VA differs from the last one sent.
+ */
+static int h265_set_scaling_matrix(struct request_data *driver_data,
+				   struct object_context *context_object,
+				   struct object_surface *surface_object)
+{
+	VAIQMatrixBufferHEVC *iqmatrix = &surface_object->params->h265.iqmatrix;
+	struct v4l2_ctrl_hevc_scaling_matrix matrix;
+	int rc;
+
+	if (context_object->h265_iqmatrix_valid &&
+	    memcmp(&context_object->h265_iqmatrix, iqmatrix,
+		   sizeof(*iqmatrix)) == 0)
+		return 0;
+
+	h265_fill_scaling_matrix(iqmatrix, &matrix);
+
+	/* The matrix only counts as sent once the request was queued. */
+	context_object->h265_iqmatrix_valid = false;
+	context_object->h265_iqmatrix_pending = false;
+
+	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
+			      V4L2_CID_STATELESS_HEVC_SCALING_MATRIX, &matrix,
+			      sizeof(matrix));
+	if (rc < 0)
+		return -1;
+
+	memcpy(&context_object->h265_iqmatrix, iqmatrix, sizeof(*iqmatrix));
+	context_object->h265_iqmatrix_pending = true;
+
+	return 0;
+}
+
+void h265_end_picture(struct object_context *context_object, bool queued)
+{
+	if (queued && context_object->h265_iqmatrix_pending)
+		context_object->h265_iqmatrix_valid = true;
+	else if (!queued)
+		context_object->h265_iqmatrix_valid = false;
+
+	context_object->h265_iqmatrix_pending = false;
+}
+
+/*
+ * Clients may pass the slice with its start code or with other NAL units
+ * (such as SEI) in front of it, so look for the first slice segment NAL unit.
+ * Data without any start code is taken as a single raw NAL unit.
+ */
+static bool h265_find_slice_nal(uint8_t *data, unsigned int size,
+				struct nal_unit *slice_unit)
+{
+	struct nal_unit unit;
+	unsigned int offset = 0;
+	uint8_t *b;
+
+	while (nal_next_unit(data, size, &offset, &unit)) {
+		if (unit.size < 2)
+			continue;
+
+		b = data + unit.offset;
+
+		/* forbidden_zero_bit and nuh_temporal_id_plus1 of 0 */
+		if ((b[0] & 0x80) != 0 ||
+		    ((b[1] >> H265_NUH_TEMPORAL_ID_PLUS1_SHIFT) &
+		     H265_NUH_TEMPORAL_ID_PLUS1_MASK) == 0)
+			continue;
+
+		if (((b[0] >> H265_NAL_UNIT_TYPE_SHIFT) &
+		     H265_NAL_UNIT_TYPE_MASK) < H265_NAL_UNIT_TYPE_VCL_MAX) {
+			*slice_unit = unit;
+			return true;
+		}
+	}
+
+	/* The NAL unit header takes two bytes. */
+	if (size < 2)
+		return false;
+
+	slice_unit->offset = 0;
+	slice_unit->size = size;
+
+	return true;
+}
+
+/*
+ * Decoders without start codes take the slice data as a single NAL unit, so
+ * the slice is rebased onto the slice segment NAL unit, leaving out whatever
+ * came before or after it. The slices are packed at end as they are rebased,
+ * so that the source buffer only holds slice data. Decoders with start codes
+ * find the slice on their own.
+ */
+static int h265_rebase_slice(struct request_data *driver_data,
+			     struct object_surface *surface_object,
+			     VASliceParameterBufferHEVC *slice,
+			     unsigned int *end)
+{
+	struct nal_unit unit;
+	uint8_t *data;
+
+	if (slice->slice_data_offset < *end ||
+	    slice->slice_data_offset > surface_object->slices_size ||
+	    slice->slice_data_size >
+		    surface_object->slices_size - slice->slice_data_offset)
+		return -1;
+
+	if (!h265_find_slice_nal((uint8_t *)surface_object->source_data +
+					 slice->slice_data_offset,
+				 slice->slice_data_size, &unit))
+		return -1;
+
+	if (driver_data->h265_annex_b) {
+		*end = slice->slice_data_offset + slice->slice_data_size;
+		return 0;
+	}
+
+	data = (uint8_t *)surface_object->source_data;
+	memmove(data + *end, data + slice->slice_data_offset + unit.offset,
+		unit.size);
+
+	slice->slice_data_offset = *end;
+	slice->slice_data_size = unit.size;
+	*end += unit.size;
+
+	return 0;
 }
 
 static void h265_fill_slice_params(VAPictureParameterBufferHEVC *picture,
 				   VASliceParameterBufferHEVC *slice,
-				   struct object_heap *surface_heap,
-				   void *source_data,
+				   uint8_t *ref_map, void *source_data,
 				   struct v4l2_ctrl_hevc_slice_params *slice_params)
 {
-	uint8_t nal_unit_type, nuh_temporal_id_plus1;
+	uint8_t nal_unit_type = 0, nuh_temporal_id_plus1 = 0;
+	uint8_t *data = (uint8_t *)source_data + slice->slice_data_offset;
+	struct nal_unit unit;
 	uint8_t *b;
 	unsigned int count, i, j;
 	uint8_t slice_type;
 
-	// Extract NAL unit header info
-	b = (uint8_t *)source_data + slice->slice_data_offset;
-	nal_unit_type = (b[0] >> H265_NAL_UNIT_TYPE_SHIFT) & H265_NAL_UNIT_TYPE_MASK;
-	nuh_temporal_id_plus1 = (b[1] >> H265_NUH_TEMPORAL_ID_PLUS1_SHIFT) & H265_NUH_TEMPORAL_ID_PLUS1_MASK;
+	/* Slices were checked to have one by h265_rebase_slice. */
+	if (h265_find_slice_nal(data, slice->slice_data_size, &unit)) {
+		b = data + unit.offset;
+		nal_unit_type = (b[0] >> H265_NAL_UNIT_TYPE_SHIFT) &
+				H265_NAL_UNIT_TYPE_MASK;
+		nuh_temporal_id_plus1 =
+			(b[1] >> H265_NUH_TEMPORAL_ID_PLUS1_SHIFT) &
+			H265_NUH_TEMPORAL_ID_PLUS1_MASK;
+	}
 
 	memset(slice_params, 0, sizeof(*slice_params));
 
 	slice_params->bit_size = slice->slice_data_size * 8;
-	// Best guess for data_byte_offset (cannot use data_bit_offset, not present in struct)
-	slice_params->data_byte_offset = slice->slice_data_offset + slice->slice_data_byte_offset;
-	slice_params->num_entry_point_offsets = 0; // Set to 0 unless you know you need it
+	slice_params->data_byte_offset = slice->slice_data_byte_offset;
+	slice_params->num_entry_point_offsets = slice->num_entry_point_offsets;
 
 	slice_params->nal_unit_type = nal_unit_type;
 	slice_params->nuh_temporal_id_plus1 = nuh_temporal_id_plus1;
@@ -145,15 +589,20 @@ static void h265_fill_slice_params(VAPictureParameterBufferHEVC *picture,
 	slice_params->slice_tc_offset_div2 = slice->slice_tc_offset_div2;
 	slice_params->pic_struct = 0; // Set as needed
 
-	slice_params->slice_segment_addr = 0; // Set as needed
+	slice_params->slice_segment_addr = slice->slice_segment_address;
 
+	/* VA indexes ReferenceFrames while V4L2 indexes the DPB array. */
 	count = slice_params->num_ref_idx_l0_active_minus1 + 1;
 	for (i = 0; i < count && slice_type != V4L2_HEVC_SLICE_TYPE_I; i++)
-		slice_params->ref_idx_l0[i] = slice->RefPicList[0][i];
+		if (slice->RefPicList[0][i] < H265_DPB_SIZE - 1)
+			slice_params->ref_idx_l0[i] =
+				ref_map[slice->RefPicList[0][i]];
 
 	count = slice_params->num_ref_idx_l1_active_minus1 + 1;
 	for (i = 0; i < count && slice_type == V4L2_HEVC_SLICE_TYPE_B; i++)
-		slice_params->ref_idx_l1[i] = slice->RefPicList[1][i];
+		if (slice->RefPicList[1][i] < H265_DPB_SIZE - 1)
+			slice_params->ref_idx_l1[i] =
+				ref_map[slice->RefPicList[1][i]];
 
 	// Weighted prediction table
 	slice_params->pred_weight_table.luma_log2_weight_denom = slice->luma_log2_weight_denom;
@@ -175,10 +624,248 @@ static void h265_fill_slice_params(VAPictureParameterBufferHEVC *picture,
 		}
 	}
 
-	slice_params->short_term_ref_pic_set_size = 0; // Set as needed
-	slice_params->long_term_ref_pic_set_size = 0; // Set as needed
+	/* VA only provides the short-term RPS size. */
+	slice_params->short_term_ref_pic_set_size = picture->st_rps_bits;
+	slice_params->long_term_ref_pic_set_size = 0;
 
 	slice_params->flags = 0;
+
+	if (slice->LongSliceFlags.fields.slice_sao_luma_flag)
+		slice_params->flags |=
+			V4L2_HEVC_SLICE_PARAMS_FLAG_SLICE_SAO_LUMA;
+
+	if (slice->LongSliceFlags.fields.slice_sao_chroma_flag)
+		slice_params->flags |=
+			V4L2_HEVC_SLICE_PARAMS_FLAG_SLICE_SAO_CHROMA;
+
+	if (slice->LongSliceFlags.fields.slice_temporal_mvp_enabled_flag)
+		slice_params->flags |=
+			V4L2_HEVC_SLICE_PARAMS_FLAG_SLICE_TEMPORAL_MVP_ENABLED;
+
+	if (slice->LongSliceFlags.fields.mvd_l1_zero_flag)
+		slice_params->flags |= V4L2_HEVC_SLICE_PARAMS_FLAG_MVD_L1_ZERO;
+
+	if (slice->LongSliceFlags.fields.cabac_init_flag)
+		slice_params->flags |= V4L2_HEVC_SLICE_PARAMS_FLAG_CABAC_INIT;
+
+	if (slice->LongSliceFlags.fields.collocated_from_l0_flag)
+		slice_params->flags |=
+			V4L2_HEVC_SLICE_PARAMS_FLAG_COLLOCATED_FROM_L0;
+
+	if (slice->LongSliceFlags.fields.slice_deblocking_filter_disabled_flag)
+		slice_params->flags |=
+			V4L2_HEVC_SLICE_PARAMS_FLAG_SLICE_DEBLOCKING_FILTER_DISABLED;
+
+	if (slice->LongSliceFlags.fields.slice_loop_filter_across_slices_enabled_flag)
+		slice_params->flags |=
+			V4L2_HEVC_SLICE_PARAMS_FLAG_SLICE_LOOP_FILTER_ACROSS_SLICES_ENABLED;
+
+	if (slice->LongSliceFlags.fields.dependent_slice_segment_flag)
+		slice_params->flags |=
+			V4L2_HEVC_SLICE_PARAMS_FLAG_DEPENDENT_SLICE_SEGMENT;
+}
+
+/*
+ * Pictures may come with any number of slices and entry points, so the arrays
+ * are grown to fit and kept for the following pictures of the context.
+ */
+static unsigned int h265_grow_size(unsigned int size, unsigned int count,
+				   unsigned int default_size)
+{
+	if (size == 0)
+		size = default_size;
+
+	while (size < count)
+		size *= 2;
+
+	return size;
+}
+
+VAStatus h265_store_slice_params(struct object_context *context_object,
+				 struct object_surface *surface_object,
+				 VASliceParameterBufferHEVC *slices,
+				 unsigned int count)
+{
+	struct v4l2_ctrl_hevc_slice_params *slice_params;
+	VASliceParameterBufferHEVC *slice;
+	unsigned int slices_count = surface_object->params->h265.slices_count;
+	unsigned int size;
+	unsigned int i;
+
+	if (slices_count + count > context_object->h265_slices_size) {
+		size = h265_grow_size(context_object->h265_slices_size,
+				      slices_count + count,
+				      H265_SLICES_DEFAULT);
+
+		slice = realloc(context_object->h265_slices,
+				size * sizeof(*slice));
+		if (slice == NULL)
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+		context_object->h265_slices = slice;
+
+		slice_params = realloc(context_object->h265_slice_params,
+				       size * sizeof(*slice_params));
+		if (slice_params == NULL)
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+		context_object->h265_slice_params = slice_params;
+		context_object->h265_slices_size = size;
+	}
+
+	for (i = 0; i < count; i++) {
+		slice = &context_object->h265_slices[
+			surface_object->params->h265.slices_count++];
+
+		memcpy(slice, &slices[i], sizeof(*slice));
+
+		/* Make the offset relative to the start of the source data. */
+		slice->slice_data_offset += surface_object->slices_size;
+	}
+
+	return VA_STATUS_SUCCESS;
+}
+
+/*
+ * The subsets buffer holds the entry point offsets of all the slices of the
+ * picture, in slice order, which is the layout of the V4L2 control as well.
+ */
+VAStatus h265_store_entry_points(struct object_context *context_object,
+				 struct object_surface *surface_object,
+				 uint32_t *entry_points, unsigned int count)
+{
+	unsigned int entry_points_count =
+		surface_object->params->h265.entry_points_count;
+	unsigned int size;
+	uint32_t *array;
+
+	if (entry_points_count + count >
+	    context_object->h265_entry_points_size) {
+		size = h265_grow_size(context_object->h265_entry_points_size,
+				      entry_points_count + count,
+				      H265_ENTRY_POINTS_DEFAULT);
+
+		array = realloc(context_object->h265_entry_points,
+				size * sizeof(*array));
+		if (array == NULL)
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+		context_object->h265_entry_points = array;
+		context_object->h265_entry_points_size = size;
+	}
+
+	memcpy(&context_object->h265_entry_points[entry_points_count],
+	       entry_points, count * sizeof(*entry_points));
+	surface_object->params->h265.entry_points_count += count;
+
+	return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Slice-based decoders take one slice per request. Every slice but the first
+ * is copied to a slice request of its own along with its parameters and entry
+ * points, while the request of the surface gets the picture controls and the
+ * first slice.
+ */
+static int h265_prepare_slices(struct request_data *driver_data,
+			       struct object_context *context_object,
+			       struct object_surface *surface_object,
+			       uint8_t *ref_map)
+{
+	VAPictureParameterBufferHEVC *picture =
+		&surface_object->params->h265.picture;
+	VASliceParameterBufferHEVC *slices = context_object->h265_slices;
+	unsigned int slices_count = surface_object->params->h265.slices_count;
+	uint32_t *entry_points = context_object->h265_entry_points;
+	unsigned int entry_points_count =
+		surface_object->params->h265.entry_points_count;
+	struct context_slice_request *slice_request;
+	struct v4l2_ctrl_hevc_slice_params slice_params;
+	VASliceParameterBufferHEVC *slice;
+	unsigned int entry_point = 0;
+	unsigned int end = 0;
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < slices_count; i++) {
+		slice = &slices[i];
+
+		if (slice->slice_data_offset < end ||
+		    slice->slice_data_offset + slice->slice_data_size >
+			    surface_object->slices_size) {
+			request_log("Invalid HEVC slice %u data range\n", i);
+			return -1;
+		}
+
+		end = slice->slice_data_offset + slice->slice_data_size;
+
+		if (entry_point + slice->num_entry_point_offsets >
+		    entry_points_count) {
+			request_log("Missing HEVC entry point offsets\n");
+			return -1;
+		}
+
+		if (i == 0) {
+			entry_point += slice->num_entry_point_offsets;
+			continue;
+		}
+
+		slice_request = context_reserve_slice(driver_data,
+						      context_object, i - 1,
+						      slice->slice_data_size);
+		if (slice_request == NULL)
+			return -1;
+
+		h265_fill_slice_params(picture, slice, ref_map,
+				       surface_object->source_data,
+				       &slice_params);
+
+		memcpy(slice_request->data,
+		       surface_object->source_data + slice->slice_data_offset,
+		       slice->slice_data_size);
+		slice_request->slice_size = slice->slice_data_size;
+
+		rc = v4l2_set_control(driver_data->video_fd,
+				      slice_request->request_fd,
+				      V4L2_CID_STATELESS_HEVC_SLICE_PARAMS,
+				      &slice_params, sizeof(slice_params));
+		if (rc < 0)
+			return -1;
+
+		if (slice->num_entry_point_offsets > 0) {
+			rc = v4l2_set_control(driver_data->video_fd,
+					      slice_request->request_fd,
+					      V4L2_CID_STATELESS_HEVC_ENTRY_POINT_OFFSETS,
+					      &entry_points[entry_point],
+					      slice->num_entry_point_offsets *
+						      sizeof(uint32_t));
+			if (rc < 0)
+				return -1;
+		}
+
+		entry_point += slice->num_entry_point_offsets;
+	}
+
+	return 0;
+}
+
+int h265_queue_slices(struct request_data *driver_data,
+		      struct object_context *context_object,
+		      struct object_surface *surface_object, bool hold_capture)
+{
+	VASliceParameterBufferHEVC *slice =
+		&context_object->h265_slices[0];
+
+	/* The other slices were copied out, the first one can move. */
+	if (slice->slice_data_offset > 0)
+		memmove(surface_object->source_data,
+			surface_object->source_data + slice->slice_data_offset,
+			slice->slice_data_size);
+
+	return context_queue_slices(driver_data, context_object,
+				    surface_object, slice->slice_data_size,
+				    surface_object->params->h265.slices_count - 1,
+				    hold_capture);
 }
 
 int h265_set_controls(struct request_data *driver_data,
@@ -186,18 +873,39 @@ int h265_set_controls(struct request_data *driver_data,
 		      struct object_surface *surface_object)
 {
 	VAPictureParameterBufferHEVC *picture =
-		&surface_object->params.h265.picture;
-	VASliceParameterBufferHEVC *slice =
-		&surface_object->params.h265.slice;
-	// VAIQMatrixBufferHEVC *iqmatrix =
-	// 	&surface_object->params.h265.iqmatrix;
-	// bool iqmatrix_set = surface_object->params.h265.iqmatrix_set;
+		&surface_object->params->h265.picture;
+	VASliceParameterBufferHEVC *slices = context_object->h265_slices;
+	unsigned int slices_count = surface_object->params->h265.slices_count;
+	unsigned int entry_points_count = 0;
+	unsigned int end = 0;
+	bool iqmatrix_set = surface_object->params->h265.iqmatrix_set;
 	struct v4l2_ctrl_hevc_pps pps;
 	struct v4l2_ctrl_hevc_sps sps;
-	struct v4l2_ctrl_hevc_slice_params slice_params;
+	struct v4l2_ctrl_hevc_slice_params *slice_params =
+		context_object->h265_slice_params;
+	struct v4l2_ctrl_hevc_decode_params decode;
+	uint8_t ref_map[H265_DPB_SIZE - 1];
+	unsigned int i;
 	int rc;
 
-	h265_fill_pps(picture, slice, &pps);
+	if (slices_count == 0) {
+		request_log("No HEVC slice parameters for this picture\n");
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
+
+	for (i = 0; i < slices_count; i++) {
+		rc = h265_rebase_slice(driver_data, surface_object, &slices[i],
+				       &end);
+		if (rc < 0) {
+			request_log("Invalid HEVC slice %u data\n", i);
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+		}
+	}
+
+	if (!driver_data->h265_annex_b)
+		surface_object->slices_size = end;
+
+	h265_fill_pps(picture, &pps);
 	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
 			      V4L2_CID_STATELESS_HEVC_PPS, &pps, sizeof(pps));
 	if (rc < 0)
@@ -209,13 +917,67 @@ int h265_set_controls(struct request_data *driver_data,
 	if (rc < 0)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
-	h265_fill_slice_params(picture, slice, &driver_data->surface_heap,
-			       surface_object->source_data, &slice_params);
+	h265_dpb_update(driver_data, context_object, picture);
+
+	h265_fill_decode_params(context_object, picture, &decode, ref_map);
+	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
+			      V4L2_CID_STATELESS_HEVC_DECODE_PARAMS, &decode,
+			      sizeof(decode));
+	if (rc < 0)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	/* Slice-based decoders get the other slices in their own requests. */
+	if (context_object->h265_slice_based && slices_count > 1) {
+		rc = h265_prepare_slices(driver_data, context_object,
+					 surface_object, ref_map);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+
+		slices_count = 1;
+	}
+
+	for (i = 0; i < slices_count; i++) {
+		h265_fill_slice_params(picture, &slices[i], ref_map,
+				       surface_object->source_data,
+				       &slice_params[i]);
+
+		entry_points_count += slices[i].num_entry_point_offsets;
+	}
+
 	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
 			      V4L2_CID_STATELESS_HEVC_SLICE_PARAMS,
-			      &slice_params, sizeof(slice_params));
+			      slice_params,
+			      slices_count * sizeof(slice_params[0]));
 	if (rc < 0)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
+	/* Tiles and WPP substreams of every slice, laid out in slice order. */
+	if (entry_points_count > 0) {
+		if (entry_points_count >
+		    surface_object->params->h265.entry_points_count) {
+			request_log("Missing HEVC entry point offsets\n");
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+		}
+
+		rc = v4l2_set_control(driver_data->video_fd,
+				      surface_object->request_fd,
+				      V4L2_CID_STATELESS_HEVC_ENTRY_POINT_OFFSETS,
+				      context_object->h265_entry_points,
+				      entry_points_count * sizeof(uint32_t));
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
+
+	if (picture->pic_fields.bits.scaling_list_enabled_flag &&
+	    iqmatrix_set) {
+		rc = h265_set_scaling_matrix(driver_data, context_object,
+					     surface_object);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
+
+	/* The current picture may be referenced by the following ones. */
+	h265_dpb_insert(driver_data, context_object, &picture->CurrPic);
+
 	return 0;
-}
\ No newline at end of file
+}
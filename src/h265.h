@@ -27,12 +27,43 @@
 #ifndef _H265_H_
 #define _H265_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <va/va.h>
+
 struct object_context;
 struct object_surface;
 struct request_data;
 
+#define H265_SLICES_DEFAULT		64
+#define H265_ENTRY_POINTS_DEFAULT	512
+#define H265_DPB_SIZE		16
+
+struct h265_dpb_entry {
+	VAPictureHEVC pic;
+	uint64_t timestamp;
+	bool used;
+	bool valid;
+};
+
+struct h265_dpb {
+	struct h265_dpb_entry entries[H265_DPB_SIZE];
+};
+
+VAStatus h265_store_slice_params(struct object_context *context_object,
+				 struct object_surface *surface_object,
+				 VASliceParameterBufferHEVC *slices,
+				 unsigned int count);
+VAStatus h265_store_entry_points(struct object_context *context_object,
+				 struct object_surface *surface_object,
+				 uint32_t *entry_points, unsigned int count);
+int h265_queue_slices(struct request_data *driver_data,
+		      struct object_context *context_object,
+		      struct object_surface *surface_object, bool hold_capture);
 int h265_set_controls(struct request_data *driver_data,
 		      struct object_context *context_object,
 		      struct object_surface *surface_object);
+void h265_end_picture(struct object_context *context_object, bool queued);
 
 #endif
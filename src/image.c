@@ -33,7 +33,9 @@
 #include <assert.h>
 #include <string.h>
 
+#include "scale.h"
 #include "tiled_yuv.h"
+#include "unpack.h"
 #include "utils.h"
 #include "v4l2.h"
 
@@ -60,12 +62,18 @@ VAStatus RequestCreateImage(VADriverContextP context, VAImageFormat *format,
 	if (video_format == NULL)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
+	/* Compressed surfaces cannot be accessed from the CPU. */
+	if (video_format_is_compressed(video_format))
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
 	capture_type = v4l2_type_video_capture(video_format->v4l2_mplane);
 
 	/*
 	 * FIXME: This should be replaced by per-pixelformat hadling to
 	 * determine the logical plane offsets and sizes;
 	 */
+	planes_count = 0;
+
 	rc = v4l2_get_format(driver_data->video_fd, capture_type,
 			     &format_width, &format_height,
 			     destination_bytesperlines, destination_sizes,
@@ -80,7 +88,13 @@ VAStatus RequestCreateImage(VADriverContextP context, VAImageFormat *format,
 	for (i = 0; i < planes_count; i++)
 		size += destination_sizes[i];
 
-	/* Here we calculate the sizes assuming NV12. */
+	/* Packed 10-bit samples are unpacked to P010 in images. */
+	if (video_format->v4l2_format == V4L2_PIX_FMT_NV15) {
+		destination_bytesperlines[0] = (format_width * 2 + 15) & ~15;
+		size = destination_bytesperlines[0] * format_height * 3 / 2;
+	}
+
+	/* Here we calculate the sizes assuming NV12 or P010. */
 
 	destination_sizes[0] = destination_bytesperlines[0] * format_height;
 
@@ -143,6 +157,24 @@ VAStatus RequestDestroyImage(VADriverContextP context, VAImageID image_id)
 	return VA_STATUS_SUCCESS;
 }
 
+static void unpack_10bit_plane(struct object_surface *surface_object,
+			       unsigned int plane, void *data,
+			       unsigned int pitch)
+{
+	unsigned int height;
+	unsigned int y;
+
+	height = plane > 0 ? surface_object->height / 2 :
+			     surface_object->height;
+
+	/* Chroma rows hold as many CbCr samples as luma rows hold Y ones. */
+	for (y = 0; y < height; y++)
+		unpack_10bit_row((unsigned char *)surface_object->destination_data[plane] +
+				 y * surface_object->destination_bytesperlines[plane],
+				 (unsigned char *)data + y * pitch,
+				 surface_object->width);
+}
+
 static VAStatus copy_surface_to_image (struct request_data *driver_data,
 				       struct object_surface *surface_object,
 				       VAImage *image)
@@ -155,7 +187,10 @@ static VAStatus copy_surface_to_image (struct request_data *driver_data,
 		return VA_STATUS_ERROR_INVALID_BUFFER;
 
 	for (i = 0; i < surface_object->destination_planes_count; i++) {
-		if (!video_format_is_linear(driver_data->video_format))
+		if (driver_data->video_format->v4l2_format == V4L2_PIX_FMT_NV15)
+			unpack_10bit_plane(surface_object, i, buffer_object->data +
+					   image->offsets[i], image->pitches[i]);
+		else if (!video_format_is_linear(driver_data->video_format))
 			tiled_to_planar(surface_object->destination_data[i],
 					buffer_object->data + image->offsets[i],
 					image->pitches[i], image->width,
@@ -171,11 +206,65 @@ static VAStatus copy_surface_to_image (struct request_data *driver_data,
 	return VA_STATUS_SUCCESS;
 }
 
+static VAStatus copy_surface_rect_to_image(struct request_data *driver_data,
+					   struct object_surface *surface_object,
+					   int x, int y, unsigned int width,
+					   unsigned int height, VAImage *image)
+{
+	struct object_buffer *buffer_object;
+	struct scale_plane src, dst;
+	unsigned int subsampling;
+	unsigned int sample_size;
+	unsigned int i;
+	int rc;
+
+	buffer_object = BUFFER(driver_data, image->buf);
+	if (buffer_object == NULL)
+		return VA_STATUS_ERROR_INVALID_BUFFER;
+
+	sample_size = driver_data->video_format->bit_depth > 8 ? 2 : 1;
+
+	/* Scaling works on 8-bit samples, 16-bit ones can only be cropped. */
+	if (driver_data->video_format->v4l2_format == V4L2_PIX_FMT_NV15 ||
+	    (sample_size > 1 &&
+	     (width != image->width || height != image->height)))
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	/* Only the rows covered by the rectangle are read from the surface. */
+	for (i = 0; i < surface_object->destination_planes_count; i++) {
+		subsampling = i > 0 ? 1 : 0;
+
+		src.data = surface_object->destination_data[i];
+		src.pitch = surface_object->destination_bytesperlines[i];
+		src.tiled = !video_format_is_linear(driver_data->video_format);
+		src.x = x >> subsampling;
+		src.y = y >> subsampling;
+		src.width = (width + subsampling) >> subsampling;
+		src.height = (height + subsampling) >> subsampling;
+
+		dst.data = buffer_object->data + image->offsets[i];
+		dst.pitch = image->pitches[i];
+		dst.tiled = false;
+		dst.x = 0;
+		dst.y = 0;
+		dst.width = (image->width + subsampling) >> subsampling;
+		dst.height = (image->height + subsampling) >> subsampling;
+
+		/* NV12 and P010 chroma samples are interleaved CbCr pairs. */
+		rc = scale_plane(&src, &dst, (i > 0 ? 2 : 1) * sample_size);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
+
+	return VA_STATUS_SUCCESS;
+}
+
 VAStatus RequestDeriveImage(VADriverContextP context, VASurfaceID surface_id,
 			    VAImage *image)
 {
 	struct request_data *driver_data = context->pDriverData;
 	struct object_surface *surface_object;
+	struct object_context *context_object;
 	struct object_buffer *buffer_object;
 	VAImageFormat format;
 	VAStatus status;
@@ -184,36 +273,41 @@ VAStatus RequestDeriveImage(VADriverContextP context, VASurfaceID surface_id,
 	if (surface_object == NULL)
 		return VA_STATUS_ERROR_INVALID_SURFACE;
 
-	if (surface_object->status == VASurfaceRendering) {
-		status = RequestSyncSurface(context, surface_id);
-		if (status != VA_STATUS_SUCCESS)
-			return status;
-	}
+	status = surface_lock(driver_data, surface_object, &context_object);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
 
-	format.fourcc = VA_FOURCC_NV12;
+	format.fourcc = driver_data->video_format->bit_depth > 8 ?
+			VA_FOURCC_P010 : VA_FOURCC_NV12;
 
 	status = RequestCreateImage(context, &format, surface_object->width,
 				    surface_object->height, image);
 	if (status != VA_STATUS_SUCCESS)
-		return status;
+		goto complete;
 
 	status = copy_surface_to_image (driver_data, surface_object, image);
 	if (status != VA_STATUS_SUCCESS)
-		return status;
+		goto complete;
 
-	surface_object->status = VASurfaceReady;
+	surface_set_status(surface_object, VASurfaceReady);
 
 	buffer_object = BUFFER(driver_data, image->buf);
 	buffer_object->derived_surface_id = surface_id;
 
-	return VA_STATUS_SUCCESS;
+	status = VA_STATUS_SUCCESS;
+
+complete:
+	surface_unlock(context_object);
+
+	return status;
 }
 
 VAStatus RequestQueryImageFormats(VADriverContextP context,
 				  VAImageFormat *formats, int *formats_count)
 {
 	formats[0].fourcc = VA_FOURCC_NV12;
-	*formats_count = 1;
+	formats[1].fourcc = VA_FOURCC_P010;
+	*formats_count = 2;
 
 	return VA_STATUS_SUCCESS;
 }
@@ -230,8 +324,10 @@ VAStatus RequestGetImage(VADriverContextP context, VASurfaceID surface_id,
 {
 	struct request_data *driver_data = context->pDriverData;
 	struct object_surface *surface_object;
+	struct object_context *context_object;
 	struct object_image *image_object;
 	VAImage *image;
+	VAStatus status;
 
 	surface_object = SURFACE(driver_data, surface_id);
 	if (surface_object == NULL)
@@ -242,17 +338,140 @@ VAStatus RequestGetImage(VADriverContextP context, VASurfaceID surface_id,
 		return VA_STATUS_ERROR_INVALID_IMAGE;
 
 	image = &image_object->image;
-	if (x != 0 || y != 0 || width != image->width || height != image->height)
-		return VA_STATUS_ERROR_UNIMPLEMENTED;
 
-	return copy_surface_to_image (driver_data, surface_object, image);
+	if (image->format.fourcc != (driver_data->video_format->bit_depth > 8 ?
+				     VA_FOURCC_P010 : VA_FOURCC_NV12))
+		return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+
+	if (x < 0 || y < 0 || width == 0 || height == 0 ||
+	    x + width > surface_object->width ||
+	    y + height > surface_object->height)
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+	status = surface_lock(driver_data, surface_object, &context_object);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
+
+	if (x == 0 && y == 0 && width == image->width &&
+	    height == image->height && width == surface_object->width &&
+	    height == surface_object->height)
+		status = copy_surface_to_image (driver_data, surface_object,
+						image);
+	else
+		status = copy_surface_rect_to_image(driver_data,
+						    surface_object, x, y,
+						    width, height, image);
+
+	surface_unlock(context_object);
+
+	return status;
+}
+
+static VAStatus copy_image_rect_to_surface(struct request_data *driver_data,
+					   VAImage *image, int src_x, int src_y,
+					   unsigned int src_width,
+					   unsigned int src_height,
+					   struct object_surface *surface_object,
+					   int dst_x, int dst_y,
+					   unsigned int dst_width,
+					   unsigned int dst_height)
+{
+	struct object_buffer *buffer_object;
+	struct scale_plane src, dst;
+	unsigned int subsampling;
+	unsigned int sample_size;
+	unsigned int i;
+	int rc;
+
+	buffer_object = BUFFER(driver_data, image->buf);
+	if (buffer_object == NULL)
+		return VA_STATUS_ERROR_INVALID_BUFFER;
+
+	sample_size = driver_data->video_format->bit_depth > 8 ? 2 : 1;
+
+	if (driver_data->video_format->v4l2_format == V4L2_PIX_FMT_NV15 ||
+	    (sample_size > 1 &&
+	     (src_width != dst_width || src_height != dst_height)))
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	/* Tiled surfaces are written back in their native layout. */
+	for (i = 0; i < surface_object->destination_planes_count; i++) {
+		subsampling = i > 0 ? 1 : 0;
+
+		src.data = buffer_object->data + image->offsets[i];
+		src.pitch = image->pitches[i];
+		src.tiled = false;
+		src.x = src_x >> subsampling;
+		src.y = src_y >> subsampling;
+		src.width = (src_width + subsampling) >> subsampling;
+		src.height = (src_height + subsampling) >> subsampling;
+
+		dst.data = surface_object->destination_data[i];
+		dst.pitch = surface_object->destination_bytesperlines[i];
+		dst.tiled = !video_format_is_linear(driver_data->video_format);
+		dst.x = dst_x >> subsampling;
+		dst.y = dst_y >> subsampling;
+		dst.width = (dst_width + subsampling) >> subsampling;
+		dst.height = (dst_height + subsampling) >> subsampling;
+
+		rc = scale_plane(&src, &dst, (i > 0 ? 2 : 1) * sample_size);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
+
+	return VA_STATUS_SUCCESS;
 }
 
 VAStatus RequestPutImage(VADriverContextP context, VASurfaceID surface_id,
-			 VAImageID image, int src_x, int src_y,
+			 VAImageID image_id, int src_x, int src_y,
 			 unsigned int src_width, unsigned int src_height,
 			 int dst_x, int dst_y, unsigned int dst_width,
 			 unsigned int dst_height)
 {
-	return VA_STATUS_ERROR_UNIMPLEMENTED;
+	struct request_data *driver_data = context->pDriverData;
+	struct object_surface *surface_object;
+	struct object_context *context_object;
+	struct object_image *image_object;
+	VAImage *image;
+	VAStatus status;
+
+	surface_object = SURFACE(driver_data, surface_id);
+	if (surface_object == NULL)
+		return VA_STATUS_ERROR_INVALID_SURFACE;
+
+	image_object = IMAGE(driver_data, image_id);
+	if (image_object == NULL)
+		return VA_STATUS_ERROR_INVALID_IMAGE;
+
+	image = &image_object->image;
+
+	if (image->format.fourcc != (driver_data->video_format->bit_depth > 8 ?
+				     VA_FOURCC_P010 : VA_FOURCC_NV12))
+		return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+
+	if (src_x < 0 || src_y < 0 || src_width == 0 || src_height == 0 ||
+	    src_x + src_width > image->width ||
+	    src_y + src_height > image->height)
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+	if (dst_x < 0 || dst_y < 0 || dst_width == 0 || dst_height == 0 ||
+	    dst_x + dst_width > surface_object->width ||
+	    dst_y + dst_height > surface_object->height)
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+	/* The decoder must be done writing to the capture buffer. */
+	status = surface_lock(driver_data, surface_object, &context_object);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
+
+	status = copy_image_rect_to_surface(driver_data, image, src_x, src_y,
+					    src_width, src_height,
+					    surface_object, dst_x, dst_y,
+					    dst_width, dst_height);
+	if (status == VA_STATUS_SUCCESS)
+		surface_object->detiled_valid = false;
+
+	surface_unlock(context_object);
+
+	return status;
 }
@@ -24,6 +24,7 @@
  */
 
 #include "mpeg2.h"
+#include "config.h"
 #include "context.h"
 #include "request.h"
 #include "surface.h"
@@ -39,116 +40,245 @@
 
 #include "v4l2.h"
 
-int mpeg2_set_controls(struct request_data *driver_data,
-		       struct object_context *context_object,
-		       struct object_surface *surface_object)
+/* ISO/IEC 13818-2 default intra matrix, in zigzag scanning order. */
+static const unsigned char mpeg2_default_intra_matrix[64] = {
+	8,  16, 16, 19, 16, 19, 22, 22, 22, 22, 22, 22, 26, 24, 26, 27,
+	27, 27, 26, 26, 26, 26, 27, 27, 27, 29, 29, 29, 34, 34, 34, 29,
+	29, 29, 27, 27, 29, 29, 32, 32, 34, 34, 37, 38, 37, 35, 35, 34,
+	35, 38, 38, 40, 40, 40, 48, 48, 46, 46, 56, 56, 58, 69, 69, 83,
+};
+
+static unsigned int mpeg2_profile_and_level(VAProfile profile)
 {
-	VAPictureParameterBufferMPEG2 *picture =
-		&surface_object->params.mpeg2.picture;
-	VASliceParameterBufferMPEG2 *slice =
-		&surface_object->params.mpeg2.slice;
-	VAIQMatrixBufferMPEG2 *iqmatrix =
-		&surface_object->params.mpeg2.iqmatrix;
-	bool iqmatrix_set = surface_object->params.mpeg2.iqmatrix_set;
-	struct v4l2_ctrl_mpeg2_slice_params slice_params;
-	struct v4l2_ctrl_mpeg2_quantization quantization;
-	struct object_surface *forward_reference_surface;
-	struct object_surface *backward_reference_surface;
-	uint64_t timestamp;
-	unsigned int i;
-	int rc;
+	/* Escape bit clear, then profile and level indications (Main level). */
+	switch (profile) {
+	case VAProfileMPEG2Simple:
+		return 0x58;
+	case VAProfileMPEG2Main:
+	default:
+		return 0x48;
+	}
+}
+
+static void mpeg2_fill_sequence(VAProfile profile,
+				VAPictureParameterBufferMPEG2 *picture,
+				struct v4l2_ctrl_mpeg2_sequence *sequence)
+{
+	memset(sequence, 0, sizeof(*sequence));
 
-	memset(&slice_params, 0, sizeof(slice_params));
+	sequence->horizontal_size = picture->horizontal_size;
+	sequence->vertical_size = picture->vertical_size;
+	/* VA does not pass the VBV size along, the source buffer bounds it. */
+	sequence->vbv_buffer_size = SOURCE_SIZE_DEFAULT;
 
-	slice_params.bit_size = surface_object->slices_size * 8;
-	slice_params.data_bit_offset = 0;
+	sequence->profile_and_level_indication =
+		mpeg2_profile_and_level(profile);
+	sequence->chroma_format = 1; // 4:2:0
 
-	slice_params.sequence.horizontal_size = picture->horizontal_size;
-	slice_params.sequence.vertical_size = picture->vertical_size;
-	slice_params.sequence.vbv_buffer_size = SOURCE_SIZE_MAX;
+	/* VA only has the per-frame flag, which is set on progressive sequences. */
+	if (picture->picture_coding_extension.bits.progressive_frame)
+		sequence->flags |= V4L2_MPEG2_SEQ_FLAG_PROGRESSIVE;
+}
+
+static void mpeg2_fill_picture(struct request_data *driver_data,
+			       struct object_surface *surface_object,
+			       VAPictureParameterBufferMPEG2 *picture,
+			       struct v4l2_ctrl_mpeg2_picture *picture_params)
+{
+	struct object_surface *forward_reference_surface;
+	struct object_surface *backward_reference_surface;
 
-	slice_params.sequence.profile_and_level_indication = 0;
-	slice_params.sequence.progressive_sequence = 0;
-	slice_params.sequence.chroma_format = 1; // 4:2:0
+	memset(picture_params, 0, sizeof(*picture_params));
 
-	slice_params.picture.picture_coding_type = picture->picture_coding_type;
-	slice_params.picture.f_code[0][0] = (picture->f_code >> 12) & 0x0f;
-	slice_params.picture.f_code[0][1] = (picture->f_code >> 8) & 0x0f;
-	slice_params.picture.f_code[1][0] = (picture->f_code >> 4) & 0x0f;
-	slice_params.picture.f_code[1][1] = (picture->f_code >> 0) & 0x0f;
+	picture_params->picture_coding_type = picture->picture_coding_type;
+	picture_params->f_code[0][0] = (picture->f_code >> 12) & 0x0f;
+	picture_params->f_code[0][1] = (picture->f_code >> 8) & 0x0f;
+	picture_params->f_code[1][0] = (picture->f_code >> 4) & 0x0f;
+	picture_params->f_code[1][1] = (picture->f_code >> 0) & 0x0f;
 
-	slice_params.picture.intra_dc_precision =
+	picture_params->intra_dc_precision =
 		picture->picture_coding_extension.bits.intra_dc_precision;
-	slice_params.picture.picture_structure =
+	picture_params->picture_structure =
 		picture->picture_coding_extension.bits.picture_structure;
-	slice_params.picture.top_field_first =
-		picture->picture_coding_extension.bits.top_field_first;
-	slice_params.picture.frame_pred_frame_dct =
-		picture->picture_coding_extension.bits.frame_pred_frame_dct;
-	slice_params.picture.concealment_motion_vectors =
-		picture->picture_coding_extension.bits
-			.concealment_motion_vectors;
-	slice_params.picture.q_scale_type =
-		picture->picture_coding_extension.bits.q_scale_type;
-	slice_params.picture.intra_vlc_format =
-		picture->picture_coding_extension.bits.intra_vlc_format;
-	slice_params.picture.alternate_scan =
-		picture->picture_coding_extension.bits.alternate_scan;
-	slice_params.picture.repeat_first_field =
-		picture->picture_coding_extension.bits.repeat_first_field;
-	slice_params.picture.progressive_frame =
-		picture->picture_coding_extension.bits.progressive_frame;
-
-	slice_params.quantiser_scale_code = slice->quantiser_scale_code;
+
+	if (picture->picture_coding_extension.bits.top_field_first)
+		picture_params->flags |= V4L2_MPEG2_PIC_FLAG_TOP_FIELD_FIRST;
+
+	if (picture->picture_coding_extension.bits.frame_pred_frame_dct)
+		picture_params->flags |= V4L2_MPEG2_PIC_FLAG_FRAME_PRED_DCT;
+
+	if (picture->picture_coding_extension.bits.concealment_motion_vectors)
+		picture_params->flags |= V4L2_MPEG2_PIC_FLAG_CONCEALMENT_MV;
+
+	if (picture->picture_coding_extension.bits.q_scale_type)
+		picture_params->flags |= V4L2_MPEG2_PIC_FLAG_Q_SCALE_TYPE;
+
+	if (picture->picture_coding_extension.bits.intra_vlc_format)
+		picture_params->flags |= V4L2_MPEG2_PIC_FLAG_INTRA_VLC;
+
+	if (picture->picture_coding_extension.bits.alternate_scan)
+		picture_params->flags |= V4L2_MPEG2_PIC_FLAG_ALT_SCAN;
+
+	if (picture->picture_coding_extension.bits.repeat_first_field)
+		picture_params->flags |= V4L2_MPEG2_PIC_FLAG_REPEAT_FIRST;
+
+	if (picture->picture_coding_extension.bits.progressive_frame)
+		picture_params->flags |= V4L2_MPEG2_PIC_FLAG_PROGRESSIVE;
 
 	forward_reference_surface =
 		SURFACE(driver_data, picture->forward_reference_picture);
 	if (forward_reference_surface == NULL)
 		forward_reference_surface = surface_object;
 
-	timestamp = v4l2_timeval_to_ns(&forward_reference_surface->timestamp);
-	slice_params.forward_ref_ts = timestamp;
+	picture_params->forward_ref_ts =
+		v4l2_timeval_to_ns(&forward_reference_surface->timestamp);
 
 	backward_reference_surface =
 		SURFACE(driver_data, picture->backward_reference_picture);
 	if (backward_reference_surface == NULL)
 		backward_reference_surface = surface_object;
 
-	timestamp = v4l2_timeval_to_ns(&backward_reference_surface->timestamp);
-	slice_params.backward_ref_ts = timestamp;
+	picture_params->backward_ref_ts =
+		v4l2_timeval_to_ns(&backward_reference_surface->timestamp);
+}
+
+/*
+ * Matrices that are not loaded keep their previous value, starting from the
+ * defaults. Chroma matrices follow the luma ones unless loaded explicitly.
+ */
+static void mpeg2_fill_quantisation(VAIQMatrixBufferMPEG2 *iqmatrix,
+				    struct v4l2_ctrl_mpeg2_quantisation *quantisation)
+{
+	if (iqmatrix->load_intra_quantiser_matrix) {
+		memcpy(quantisation->intra_quantiser_matrix,
+		       iqmatrix->intra_quantiser_matrix, 64);
+		memcpy(quantisation->chroma_intra_quantiser_matrix,
+		       iqmatrix->intra_quantiser_matrix, 64);
+	}
+
+	if (iqmatrix->load_non_intra_quantiser_matrix) {
+		memcpy(quantisation->non_intra_quantiser_matrix,
+		       iqmatrix->non_intra_quantiser_matrix, 64);
+		memcpy(quantisation->chroma_non_intra_quantiser_matrix,
+		       iqmatrix->non_intra_quantiser_matrix, 64);
+	}
+
+	if (iqmatrix->load_chroma_intra_quantiser_matrix)
+		memcpy(quantisation->chroma_intra_quantiser_matrix,
+		       iqmatrix->chroma_intra_quantiser_matrix, 64);
+
+	if (iqmatrix->load_chroma_non_intra_quantiser_matrix)
+		memcpy(quantisation->chroma_non_intra_quantiser_matrix,
+		       iqmatrix->chroma_non_intra_quantiser_matrix, 64);
+}
+
+static void mpeg2_default_quantisation(struct v4l2_ctrl_mpeg2_quantisation *quantisation)
+{
+	memcpy(quantisation->intra_quantiser_matrix,
+	       mpeg2_default_intra_matrix, 64);
+	memcpy(quantisation->chroma_intra_quantiser_matrix,
+	       mpeg2_default_intra_matrix, 64);
+	memset(quantisation->non_intra_quantiser_matrix, 16, 64);
+	memset(quantisation->chroma_non_intra_quantiser_matrix, 16, 64);
+}
+
+int mpeg2_set_controls(struct request_data *driver_data,
+		       struct object_context *context_object,
+		       struct object_surface *surface_object)
+{
+	VAPictureParameterBufferMPEG2 *picture =
+		&surface_object->params->mpeg2.picture;
+	VAIQMatrixBufferMPEG2 *iqmatrix =
+		&surface_object->params->mpeg2.iqmatrix;
+	bool iqmatrix_set = surface_object->params->mpeg2.iqmatrix_set;
+	struct mpeg2_header_state *state = &context_object->mpeg2;
+	struct v4l2_ctrl_mpeg2_quantisation quantisation;
+	struct v4l2_ctrl_mpeg2_sequence sequence;
+	struct v4l2_ctrl_mpeg2_picture picture_params;
+	struct object_config *config_object;
+	int rc;
+
+	config_object = CONFIG(driver_data, context_object->config_id);
+	if (config_object == NULL)
+		return VA_STATUS_ERROR_INVALID_CONFIG;
+
+	/*
+	 * Controls left out of a request keep their current value, so the
+	 * sequence and quantisation ones only go out when they change. All
+	 * the slices of the picture are in the source buffer, which the
+	 * decoder parses on its own.
+	 */
+	mpeg2_fill_sequence(config_object->profile, picture, &sequence);
+
+	if (!state->sequence_valid ||
+	    memcmp(&state->sequence, &sequence, sizeof(sequence)) != 0) {
+		rc = v4l2_set_control(driver_data->video_fd,
+				      surface_object->request_fd,
+				      V4L2_CID_STATELESS_MPEG2_SEQUENCE,
+				      &sequence, sizeof(sequence));
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+
+		memcpy(&state->pending_sequence, &sequence, sizeof(sequence));
+		state->sequence_pending = true;
+	}
+
+	mpeg2_fill_picture(driver_data, surface_object, picture,
+			   &picture_params);
 
 	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
-			      V4L2_CID_MPEG_VIDEO_MPEG2_SLICE_PARAMS,
-			      &slice_params, sizeof(slice_params));
+			      V4L2_CID_STATELESS_MPEG2_PICTURE,
+			      &picture_params, sizeof(picture_params));
 	if (rc < 0)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
-	if (iqmatrix_set) {
-		quantization.load_intra_quantiser_matrix =
-			iqmatrix->load_intra_quantiser_matrix;
-		quantization.load_non_intra_quantiser_matrix =
-			iqmatrix->load_non_intra_quantiser_matrix;
-		quantization.load_chroma_intra_quantiser_matrix =
-			iqmatrix->load_chroma_intra_quantiser_matrix;
-		quantization.load_chroma_non_intra_quantiser_matrix =
-			iqmatrix->load_chroma_non_intra_quantiser_matrix;
-
-		for (i = 0; i < 64; i++) {
-			quantization.intra_quantiser_matrix[i] =
-				iqmatrix->intra_quantiser_matrix[i];
-			quantization.non_intra_quantiser_matrix[i] =
-				iqmatrix->non_intra_quantiser_matrix[i];
-			quantization.chroma_intra_quantiser_matrix[i] =
-				iqmatrix->chroma_intra_quantiser_matrix[i];
-			quantization.chroma_non_intra_quantiser_matrix[i] =
-				iqmatrix->chroma_non_intra_quantiser_matrix[i];
-		}
+	if (state->quantisation_valid)
+		memcpy(&quantisation, &state->quantisation,
+		       sizeof(quantisation));
+	else
+		mpeg2_default_quantisation(&quantisation);
 
+	if (iqmatrix_set)
+		mpeg2_fill_quantisation(iqmatrix, &quantisation);
+
+	if (!state->quantisation_valid ||
+	    memcmp(&state->quantisation, &quantisation,
+		   sizeof(quantisation)) != 0) {
 		rc = v4l2_set_control(driver_data->video_fd,
 				      surface_object->request_fd,
-				      V4L2_CID_MPEG_VIDEO_MPEG2_QUANTIZATION,
-				      &quantization, sizeof(quantization));
+				      V4L2_CID_STATELESS_MPEG2_QUANTISATION,
+				      &quantisation, sizeof(quantisation));
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+
+		memcpy(&state->pending_quantisation, &quantisation,
+		       sizeof(quantisation));
+		state->quantisation_pending = true;
 	}
 
 	return 0;
 }
+
+/*
+ * The decoder only got the pending controls if the request was queued. When
+ * it was not, the ones last sent are still current.
+ */
+void mpeg2_end_picture(struct object_context *context_object, bool queued)
+{
+	struct mpeg2_header_state *state = &context_object->mpeg2;
+
+	if (queued && state->sequence_pending) {
+		memcpy(&state->sequence, &state->pending_sequence,
+		       sizeof(state->sequence));
+		state->sequence_valid = true;
+	}
+
+	if (queued && state->quantisation_pending) {
+		memcpy(&state->quantisation, &state->pending_quantisation,
+		       sizeof(state->quantisation));
+		state->quantisation_valid = true;
+	}
+
+	state->sequence_pending = false;
+	state->quantisation_pending = false;
+}
@@ -26,12 +26,33 @@
 #ifndef _MPEG2_H_
 #define _MPEG2_H_
 
+#include <stdbool.h>
+
+#include <linux/videodev2.h>
+
 struct object_context;
 struct object_surface;
 struct request_data;
 
+/*
+ * Sequence and quantisation controls last sent, which are only sent again
+ * when they change. Controls attached to the request of the current picture
+ * are pending until the request was queued.
+ */
+struct mpeg2_header_state {
+	struct v4l2_ctrl_mpeg2_sequence sequence;
+	struct v4l2_ctrl_mpeg2_quantisation quantisation;
+	struct v4l2_ctrl_mpeg2_sequence pending_sequence;
+	struct v4l2_ctrl_mpeg2_quantisation pending_quantisation;
+	bool sequence_valid;
+	bool quantisation_valid;
+	bool sequence_pending;
+	bool quantisation_pending;
+};
+
 int mpeg2_set_controls(struct request_data *driver_data,
 		       struct object_context *context,
 		       struct object_surface *surface_object);
+void mpeg2_end_picture(struct object_context *context_object, bool queued);
 
 #endif
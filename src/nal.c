@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2026 libva-v4l2-request contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "nal.h"
+
+static bool nal_start_code_at(const unsigned char *data, unsigned int size,
+			      unsigned int offset)
+{
+	return offset + 3 <= size && data[offset] == 0x00 &&
+	       data[offset + 1] == 0x00 && data[offset + 2] == 0x01;
+}
+
+/*
+ * Start codes are looked for 16 bytes at a time, by matching each byte and
+ * the next against zero. Emulation prevention keeps two zero bytes in a row
+ * rare within NAL units, so candidates only need checking one by one when a
+ * block has such a pair.
+ */
+unsigned int nal_find_start_code(const unsigned char *data, unsigned int size,
+				 unsigned int offset)
+{
+#if defined(__ARM_NEON)
+	uint8x16_t zero = vdupq_n_u8(0);
+	uint8x16_t pairs;
+	uint64x2_t lanes;
+	unsigned int i;
+
+	for (; offset + 17 <= size; offset += 16) {
+		pairs = vandq_u8(vceqq_u8(vld1q_u8(data + offset), zero),
+				 vceqq_u8(vld1q_u8(data + offset + 1), zero));
+		lanes = vreinterpretq_u64_u8(pairs);
+
+		if ((vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1)) == 0)
+			continue;
+
+		for (i = 0; i < 16; i++)
+			if (nal_start_code_at(data, size, offset + i))
+				return offset + i;
+	}
+#elif defined(__SSE2__)
+	__m128i zero = _mm_setzero_si128();
+	__m128i first, second;
+	unsigned int mask;
+	unsigned int i;
+
+	for (; offset + 17 <= size; offset += 16) {
+		first = _mm_loadu_si128((const __m128i *)(data + offset));
+		second = _mm_loadu_si128((const __m128i *)(data + offset + 1));
+		mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(first, zero),
+			_mm_cmpeq_epi8(second, zero)));
+
+		while (mask != 0) {
+			i = __builtin_ctz(mask);
+			if (nal_start_code_at(data, size, offset + i))
+				return offset + i;
+
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	for (; offset + 3 <= size; offset++)
+		if (nal_start_code_at(data, size, offset))
+			return offset;
+
+	return size;
+}
+
+bool nal_next_unit(const unsigned char *data, unsigned int size,
+		   unsigned int *offset, struct nal_unit *unit)
+{
+	unsigned int start, end;
+
+	start = nal_find_start_code(data, size, *offset);
+	if (start >= size)
+		return false;
+
+	start += 3;
+	end = nal_find_start_code(data, size, start);
+
+	/*
+	 * NAL units never end with a zero byte, those belong to the next
+	 * start code (zero_byte or trailing_zero_8bits).
+	 */
+	while (end > start && data[end - 1] == 0x00)
+		end--;
+
+	unit->offset = start;
+	unit->size = end - start;
+
+	*offset = end;
+
+	return true;
+}
+
+unsigned int nal_start_code_size(const unsigned char *data, unsigned int size)
+{
+	unsigned int offset;
+
+	for (offset = 0; offset < size && data[offset] == 0x00; offset++)
+		if (nal_start_code_at(data, size, offset))
+			return offset + 3;
+
+	return 0;
+}
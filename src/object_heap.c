@@ -23,6 +23,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "object_heap.h"
 
@@ -35,21 +36,35 @@ static int object_heap_expand(struct object_heap *heap)
 	int next_free;
 	int i;
 
+	/*
+	 * Lookups may still be going through the current bucket array, so
+	 * it is replaced by a copy twice as large rather than reallocated.
+	 */
 	if (bucket_index >= heap->num_buckets) {
-		int new_num_buckets = heap->num_buckets + 8;
+		int new_num_buckets = heap->num_buckets > 0 ?
+			heap->num_buckets * 2 : 8;
 		void **new_bucket;
 
-		new_bucket = realloc(heap->bucket,
-				     new_num_buckets * sizeof(void *));
+		if (heap->num_old_buckets >= OBJECT_HEAP_MAX_OLD_BUCKETS)
+			return -1;
+
+		new_bucket = malloc(new_num_buckets * sizeof(void *));
 		if (new_bucket == NULL)
 			return -1;
 
+		if (heap->bucket != NULL) {
+			memcpy(new_bucket, heap->bucket,
+			       heap->num_buckets * sizeof(void *));
+			heap->old_buckets[heap->num_old_buckets++] =
+				heap->bucket;
+		}
+
 		heap->num_buckets = new_num_buckets;
-		heap->bucket = new_bucket;
+		__atomic_store_n(&heap->bucket, new_bucket, __ATOMIC_RELEASE);
 	}
 
-	new_heap_index = malloc(heap->heap_increment * heap->object_size);
-	if (new_heap_index == NULL)
+	if (posix_memalign(&new_heap_index, OBJECT_HEAP_ALIGNMENT,
+			   heap->heap_increment * heap->object_size) != 0)
 		return -1;
 
 	heap->bucket[bucket_index] = new_heap_index;
@@ -65,7 +80,7 @@ static int object_heap_expand(struct object_heap *heap)
 	}
 
 	heap->next_free = next_free;
-	heap->heap_size = new_heap_size;
+	__atomic_store_n(&heap->heap_size, new_heap_size, __ATOMIC_RELEASE);
 
 	return 0;
 }
@@ -88,7 +103,8 @@ static int object_heap_allocate_unlocked(struct object_heap *heap)
 	object = (struct object_base *)(heap->bucket[bucket_index] +
 					object_index * heap->object_size);
 	heap->next_free = object->next_free;
-	object->next_free = OBJECT_HEAP_ALLOCATED;
+	__atomic_store_n(&object->next_free, OBJECT_HEAP_ALLOCATED,
+			 __ATOMIC_RELEASE);
 
 	return object->id;
 }
@@ -104,6 +120,7 @@ int object_heap_init(struct object_heap *heap, int object_size, int id_offset)
 	heap->next_free = OBJECT_HEAP_LAST;
 	heap->num_buckets = 0;
 	heap->bucket = NULL;
+	heap->num_old_buckets = 0;
 
 	return object_heap_expand(heap);
 }
@@ -119,40 +136,39 @@ int object_heap_allocate(struct object_heap *heap)
 	return rc;
 }
 
-static struct object_base *object_heap_lookup_unlocked(struct object_heap *heap,
-						       int id)
+/*
+ * The heap size is loaded before the bucket array, which is published before
+ * it, so the bucket of any object within that size is always there.
+ */
+struct object_base *object_heap_lookup(struct object_heap *heap, int id)
 {
 	struct object_base *object;
 	int bucket_index, object_index;
+	int heap_size;
+	void **bucket;
+
+	heap_size = __atomic_load_n(&heap->heap_size, __ATOMIC_ACQUIRE);
 
 	if ((id < heap->id_offset) ||
-	    (id > (heap->heap_size + heap->id_offset)))
+	    (id >= (heap_size + heap->id_offset)))
 		return NULL;
 
 	id &= OBJECT_HEAP_ID_MASK;
 	bucket_index = id / heap->heap_increment;
 	object_index = id % heap->heap_increment;
 
-	object = (struct object_base *)(heap->bucket[bucket_index] +
+	bucket = __atomic_load_n(&heap->bucket, __ATOMIC_ACQUIRE);
+
+	object = (struct object_base *)(bucket[bucket_index] +
 					object_index * heap->object_size);
 
-	if (object->next_free != OBJECT_HEAP_ALLOCATED)
+	if (__atomic_load_n(&object->next_free, __ATOMIC_ACQUIRE) !=
+	    OBJECT_HEAP_ALLOCATED)
 		return NULL;
 
 	return object;
 }
 
-struct object_base *object_heap_lookup(struct object_heap *heap, int id)
-{
-	struct object_base *object;
-
-	pthread_mutex_lock(&heap->mutex);
-	object = object_heap_lookup_unlocked(heap, id);
-	pthread_mutex_unlock(&heap->mutex);
-
-	return object;
-}
-
 struct object_base *object_heap_first(struct object_heap *heap, int *iterator)
 {
 	*iterator = -1;
@@ -201,7 +217,8 @@ struct object_base *object_heap_next(struct object_heap *heap, int *iterator)
 static void object_heap_free_unlocked(struct object_heap *heap,
 				      struct object_base *object)
 {
-	object->next_free = heap->next_free;
+	__atomic_store_n(&object->next_free, heap->next_free,
+			 __ATOMIC_RELEASE);
 	heap->next_free = object->id & OBJECT_HEAP_ID_MASK;
 }
 
@@ -224,8 +241,13 @@ void object_heap_destroy(struct object_heap *heap)
 
 	pthread_mutex_destroy(&heap->mutex);
 
+	for (i = 0; i < heap->num_old_buckets; i++)
+		free(heap->old_buckets[i]);
+
 	free(heap->bucket);
 	heap->bucket = NULL;
+	heap->num_buckets = 0;
+	heap->num_old_buckets = 0;
 	heap->heap_size = 0;
 	heap->next_free = OBJECT_HEAP_LAST;
 }
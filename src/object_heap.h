@@ -37,6 +37,11 @@
 #define OBJECT_HEAP_LAST					-1
 #define OBJECT_HEAP_ALLOCATED					-2
 
+#define OBJECT_HEAP_MAX_OLD_BUCKETS				32
+
+/* Objects start on a cache line when their size is a multiple of it. */
+#define OBJECT_HEAP_ALIGNMENT					64
+
 /*
  * Structures
  */
@@ -46,6 +51,11 @@ struct object_base {
 	int next_free;
 };
 
+/*
+ * Allocation and free are serialized by the mutex while lookups are lock-free:
+ * bucket and heap_size are published atomically and the bucket arrays that
+ * get replaced when growing are kept around until the heap is destroyed.
+ */
 struct object_heap {
 	pthread_mutex_t mutex;
 	int object_size;
@@ -55,6 +65,8 @@ struct object_heap {
 	int heap_increment;
 	void **bucket;
 	int num_buckets;
+	void **old_buckets[OBJECT_HEAP_MAX_OLD_BUCKETS];
+	int num_old_buckets;
 };
 
 /*
@@ -31,9 +31,12 @@
 #include "request.h"
 #include "surface.h"
 
+#include "av1.h"
 #include "h264.h"
 #include "h265.h"
 #include "mpeg2.h"
+#include "vp8.h"
+#include "vp9.h"
 
 #include <assert.h>
 #include <string.h>
@@ -45,18 +48,188 @@
 #include <linux/videodev2.h>
 
 #include "media.h"
+#include "nal.h"
 #include "utils.h"
 #include "v4l2.h"
 
 #include "autoconfig.h"
 
+static const unsigned char annex_b_start_code[] = { 0x00, 0x00, 0x01 };
+
+static bool codec_annex_b(struct request_data *driver_data, VAProfile profile)
+{
+	switch (profile) {
+	case VAProfileH264Main:
+	case VAProfileH264High:
+	case VAProfileH264ConstrainedBaseline:
+	case VAProfileH264MultiviewHigh:
+	case VAProfileH264StereoHigh:
+#if VA_CHECK_VERSION(1, 18, 0)
+	case VAProfileH264High10:
+#endif
+		return driver_data->h264_annex_b;
+
+	case VAProfileHEVCMain:
+	case VAProfileHEVCMain10:
+		return driver_data->h265_annex_b;
+
+	default:
+		return false;
+	}
+}
+
+/*
+ * Returns the size of the start code added in front of the slice, which is
+ * none when the client already provided one.
+ */
+static int copy_slice_annex_b(struct request_data *driver_data,
+			      struct object_context *context_object,
+			      struct object_surface *surface_object,
+			      void *data, unsigned int size)
+{
+	unsigned char *destination;
+	unsigned int prefix_size;
+	int rc;
+
+	prefix_size = nal_start_code_size(data, size) > 0 ?
+		0 : sizeof(annex_b_start_code);
+
+	rc = context_reserve_source(driver_data, context_object, surface_object,
+				    surface_object->slices_size + prefix_size +
+					    size);
+	if (rc < 0)
+		return -1;
+
+	destination = (unsigned char *)surface_object->source_data +
+		      surface_object->slices_size;
+
+	memcpy(destination, annex_b_start_code, prefix_size);
+	memcpy(destination + prefix_size, data, size);
+
+	surface_object->slices_size += prefix_size + size;
+
+	return prefix_size;
+}
+
+/*
+ * VA hands over raw NAL units, so decoders that expect Annex B get a start
+ * code in front of each slice while it is copied. The slices parameters
+ * stored since the previous data buffer are moved to where their slice ends
+ * up, including the start code.
+ */
+static VAStatus codec_store_slices_annex_b(struct request_data *driver_data,
+					   struct object_context *context_object,
+					   VAProfile profile,
+					   struct object_surface *surface_object,
+					   struct object_buffer *buffer_object)
+{
+	VASliceParameterBufferH264 *h264_slice;
+	VASliceParameterBufferHEVC *h265_slice;
+	unsigned int data_size = buffer_object->size * buffer_object->count;
+	unsigned int base = surface_object->slices_size;
+	unsigned int first, count, i;
+	uint32_t *offset, *size;
+	unsigned char *data;
+	bool h265;
+	int rc;
+
+	h265 = profile == VAProfileHEVCMain || profile == VAProfileHEVCMain10;
+
+	if (h265) {
+		first = surface_object->params->h265.slices_copied;
+		count = surface_object->params->h265.slices_count;
+	} else {
+		first = surface_object->params->h264.slices_copied;
+		count = surface_object->params->h264.slices_count;
+	}
+
+	/* Without slice parameters, the whole buffer is one slice. */
+	if (first == count) {
+		rc = copy_slice_annex_b(driver_data, context_object,
+					surface_object, buffer_object->data,
+					data_size);
+		if (rc < 0)
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+		surface_object->slices_count++;
+
+		return VA_STATUS_SUCCESS;
+	}
+
+	for (i = first; i < count; i++) {
+		h265_slice = NULL;
+
+		if (h265) {
+			h265_slice = &context_object->h265_slices[i];
+			offset = &h265_slice->slice_data_offset;
+			size = &h265_slice->slice_data_size;
+		} else {
+			h264_slice = &context_object->h264_slices[i];
+			offset = &h264_slice->slice_data_offset;
+			size = &h264_slice->slice_data_size;
+		}
+
+		if (*offset < base || *offset - base > data_size ||
+		    *size > data_size - (*offset - base)) {
+			request_log("Invalid slice %u data range\n", i);
+			return VA_STATUS_ERROR_INVALID_PARAMETER;
+		}
+
+		data = (unsigned char *)buffer_object->data + *offset - base;
+		*offset = surface_object->slices_size;
+
+		rc = copy_slice_annex_b(driver_data, context_object,
+					surface_object, data, *size);
+		if (rc < 0)
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+		*size += rc;
+
+		if (h265_slice != NULL)
+			h265_slice->slice_data_byte_offset += rc;
+	}
+
+	if (h265)
+		surface_object->params->h265.slices_copied = count;
+	else
+		surface_object->params->h264.slices_copied = count;
+
+	surface_object->slices_count++;
+
+	return VA_STATUS_SUCCESS;
+}
+
 static VAStatus codec_store_buffer(struct request_data *driver_data,
+				   struct object_context *context_object,
 				   VAProfile profile,
 				   struct object_surface *surface_object,
 				   struct object_buffer *buffer_object)
 {
+	unsigned long long size;
+	int rc;
+
 	switch (buffer_object->type) {
 	case VASliceDataBufferType:
+		if (codec_annex_b(driver_data, profile))
+			return codec_store_slices_annex_b(driver_data,
+							  context_object,
+							  profile,
+							  surface_object,
+							  buffer_object);
+
+		size = (unsigned long long)buffer_object->size *
+		       buffer_object->count + surface_object->slices_size;
+		if (size > SOURCE_SIZE_LIMIT) {
+			request_log("Bitstream of %llu bytes is too large\n",
+				    size);
+			return VA_STATUS_ERROR_NOT_ENOUGH_BUFFER;
+		}
+
+		rc = context_reserve_source(driver_data, context_object,
+					    surface_object, size);
+		if (rc < 0)
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
 		/*
 		 * Since there is no guarantee that the allocation
 		 * order is the same as the submission order (via
@@ -67,8 +240,7 @@ static VAStatus codec_store_buffer(struct request_data *driver_data,
 			       surface_object->slices_size,
 		       buffer_object->data,
 		       buffer_object->size * buffer_object->count);
-		surface_object->slices_size +=
-			buffer_object->size * buffer_object->count;
+		surface_object->slices_size = size;
 		surface_object->slices_count++;
 		break;
 
@@ -76,9 +248,10 @@ static VAStatus codec_store_buffer(struct request_data *driver_data,
 		switch (profile) {
 		case VAProfileMPEG2Simple:
 		case VAProfileMPEG2Main:
-			memcpy(&surface_object->params.mpeg2.picture,
+			memcpy(&surface_object->params->mpeg2.picture,
 			       buffer_object->data,
-			       sizeof(surface_object->params.mpeg2.picture));
+			       sizeof(surface_object->params->mpeg2.picture));
+			surface_object->params->mpeg2.iqmatrix_set = false;
 			break;
 
 		case VAProfileH264Main:
@@ -86,17 +259,49 @@ static VAStatus codec_store_buffer(struct request_data *driver_data,
 		case VAProfileH264ConstrainedBaseline:
 		case VAProfileH264MultiviewHigh:
 		case VAProfileH264StereoHigh:
-			memcpy(&surface_object->params.h264.picture,
+#if VA_CHECK_VERSION(1, 18, 0)
+		case VAProfileH264High10:
+#endif
+			memcpy(&surface_object->params->h264.picture,
 			       buffer_object->data,
-			       sizeof(surface_object->params.h264.picture));
+			       sizeof(surface_object->params->h264.picture));
+			surface_object->params->h264.slices_count = 0;
+			surface_object->params->h264.slices_copied = 0;
 			break;
 
 		case VAProfileHEVCMain:
-			memcpy(&surface_object->params.h265.picture,
+		case VAProfileHEVCMain10:
+			memcpy(&surface_object->params->h265.picture,
+			       buffer_object->data,
+			       sizeof(surface_object->params->h265.picture));
+			surface_object->params->h265.slices_count = 0;
+			surface_object->params->h265.slices_copied = 0;
+			surface_object->params->h265.entry_points_count = 0;
+			surface_object->params->h265.iqmatrix_set = false;
+			break;
+
+		case VAProfileVP8Version0_3:
+			memcpy(&surface_object->params->vp8.picture,
 			       buffer_object->data,
-			       sizeof(surface_object->params.h265.picture));
+			       sizeof(surface_object->params->vp8.picture));
 			break;
 
+		case VAProfileVP9Profile0:
+		case VAProfileVP9Profile2:
+			memcpy(&surface_object->params->vp9.picture,
+			       buffer_object->data,
+			       sizeof(surface_object->params->vp9.picture));
+			break;
+
+#if VA_CHECK_VERSION(1, 8, 0)
+		case VAProfileAV1Profile0:
+			memcpy(&surface_object->params->av1.picture,
+			       buffer_object->data,
+			       sizeof(surface_object->params->av1.picture));
+			surface_object->params->av1.tiles_count = 0;
+			break;
+#endif
+
 		default:
 			break;
 		}
@@ -109,17 +314,34 @@ static VAStatus codec_store_buffer(struct request_data *driver_data,
 		case VAProfileH264ConstrainedBaseline:
 		case VAProfileH264MultiviewHigh:
 		case VAProfileH264StereoHigh:
-			memcpy(&surface_object->params.h264.slice,
-			       buffer_object->data,
-			       sizeof(surface_object->params.h264.slice));
-			break;
+#if VA_CHECK_VERSION(1, 18, 0)
+		case VAProfileH264High10:
+#endif
+			return h264_store_slice_params(context_object,
+						       surface_object,
+						       buffer_object->data,
+						       buffer_object->count);
 
 		case VAProfileHEVCMain:
-			memcpy(&surface_object->params.h265.slice,
+		case VAProfileHEVCMain10:
+			return h265_store_slice_params(context_object,
+						       surface_object,
+						       buffer_object->data,
+						       buffer_object->count);
+
+		case VAProfileVP8Version0_3:
+			memcpy(&surface_object->params->vp8.slice,
 			       buffer_object->data,
-			       sizeof(surface_object->params.h265.slice));
+			       sizeof(surface_object->params->vp8.slice));
 			break;
 
+#if VA_CHECK_VERSION(1, 8, 0)
+		case VAProfileAV1Profile0:
+			return av1_store_slice_params(surface_object,
+						      buffer_object->data,
+						      buffer_object->count);
+#endif
+
 		default:
 			break;
 		}
@@ -129,10 +351,10 @@ static VAStatus codec_store_buffer(struct request_data *driver_data,
 		switch (profile) {
 		case VAProfileMPEG2Simple:
 		case VAProfileMPEG2Main:
-			memcpy(&surface_object->params.mpeg2.iqmatrix,
+			memcpy(&surface_object->params->mpeg2.iqmatrix,
 			       buffer_object->data,
-			       sizeof(surface_object->params.mpeg2.iqmatrix));
-			surface_object->params.mpeg2.iqmatrix_set = true;
+			       sizeof(surface_object->params->mpeg2.iqmatrix));
+			surface_object->params->mpeg2.iqmatrix_set = true;
 			break;
 
 		case VAProfileH264Main:
@@ -140,16 +362,57 @@ static VAStatus codec_store_buffer(struct request_data *driver_data,
 		case VAProfileH264ConstrainedBaseline:
 		case VAProfileH264MultiviewHigh:
 		case VAProfileH264StereoHigh:
-			memcpy(&surface_object->params.h264.matrix,
+#if VA_CHECK_VERSION(1, 18, 0)
+		case VAProfileH264High10:
+#endif
+			memcpy(&surface_object->params->h264.matrix,
 			       buffer_object->data,
-			       sizeof(surface_object->params.h264.matrix));
+			       sizeof(surface_object->params->h264.matrix));
 			break;
 
 		case VAProfileHEVCMain:
-			memcpy(&surface_object->params.h265.iqmatrix,
+		case VAProfileHEVCMain10:
+			memcpy(&surface_object->params->h265.iqmatrix,
 			       buffer_object->data,
-			       sizeof(surface_object->params.h265.iqmatrix));
-			surface_object->params.h265.iqmatrix_set = true;
+			       sizeof(surface_object->params->h265.iqmatrix));
+			surface_object->params->h265.iqmatrix_set = true;
+			break;
+
+		case VAProfileVP8Version0_3:
+			memcpy(&surface_object->params->vp8.iqmatrix,
+			       buffer_object->data,
+			       sizeof(surface_object->params->vp8.iqmatrix));
+			break;
+
+		default:
+			break;
+		}
+		break;
+
+#if VA_CHECK_VERSION(1, 2, 0)
+	case VASubsetsParameterBufferType:
+		switch (profile) {
+		case VAProfileHEVCMain:
+		case VAProfileHEVCMain10:
+			return h265_store_entry_points(context_object,
+						       surface_object,
+						       buffer_object->data,
+						       buffer_object->size *
+							       buffer_object->count /
+							       sizeof(uint32_t));
+
+		default:
+			break;
+		}
+		break;
+#endif
+
+	case VAProbabilityBufferType:
+		switch (profile) {
+		case VAProfileVP8Version0_3:
+			memcpy(&surface_object->params->vp8.probabilities,
+			       buffer_object->data,
+			       sizeof(surface_object->params->vp8.probabilities));
 			break;
 
 		default:
@@ -184,17 +447,42 @@ static VAStatus codec_set_controls(struct request_data *driver_data,
 	case VAProfileH264ConstrainedBaseline:
 	case VAProfileH264MultiviewHigh:
 	case VAProfileH264StereoHigh:
+#if VA_CHECK_VERSION(1, 18, 0)
+	case VAProfileH264High10:
+#endif
 		rc = h264_set_controls(driver_data, context, surface_object);
 		if (rc < 0)
 			return VA_STATUS_ERROR_OPERATION_FAILED;
 		break;
 
 	case VAProfileHEVCMain:
+	case VAProfileHEVCMain10:
 		rc = h265_set_controls(driver_data, context, surface_object);
 		if (rc < 0)
 			return VA_STATUS_ERROR_OPERATION_FAILED;
 		break;
 
+	case VAProfileVP8Version0_3:
+		rc = vp8_set_controls(driver_data, context, surface_object);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+		break;
+
+	case VAProfileVP9Profile0:
+	case VAProfileVP9Profile2:
+		rc = vp9_set_controls(driver_data, context, surface_object);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+		break;
+
+#if VA_CHECK_VERSION(1, 8, 0)
+	case VAProfileAV1Profile0:
+		rc = av1_set_controls(driver_data, context, surface_object);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+		break;
+#endif
+
 	default:
 		return VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
 	}
@@ -202,12 +490,56 @@ static VAStatus codec_set_controls(struct request_data *driver_data,
 	return VA_STATUS_SUCCESS;
 }
 
+/*
+ * Whether the capture buffer has to be held after this picture, for the
+ * following one to complete it.
+ */
+static bool codec_hold_capture(VAProfile profile,
+			       struct object_surface *surface_object)
+{
+	switch (profile) {
+	case VAProfileH264Main:
+	case VAProfileH264High:
+	case VAProfileH264ConstrainedBaseline:
+	case VAProfileH264MultiviewHigh:
+	case VAProfileH264StereoHigh:
+#if VA_CHECK_VERSION(1, 18, 0)
+	case VAProfileH264High10:
+#endif
+		return h264_is_first_field(surface_object);
+
+	default:
+		return false;
+	}
+}
+
+/* Codec state that depends on the request having been queued. */
+static void codec_end_picture(VAProfile profile,
+			      struct object_context *context_object, bool queued)
+{
+	switch (profile) {
+	case VAProfileMPEG2Simple:
+	case VAProfileMPEG2Main:
+		mpeg2_end_picture(context_object, queued);
+		break;
+
+	case VAProfileHEVCMain:
+	case VAProfileHEVCMain10:
+		h265_end_picture(context_object, queued);
+		break;
+
+	default:
+		break;
+	}
+}
+
 VAStatus RequestBeginPicture(VADriverContextP context, VAContextID context_id,
 			     VASurfaceID surface_id)
 {
 	struct request_data *driver_data = context->pDriverData;
 	struct object_context *context_object;
 	struct object_surface *surface_object;
+	VAStatus status;
 
 	context_object = CONTEXT(driver_data, context_id);
 	if (context_object == NULL)
@@ -217,13 +549,32 @@ VAStatus RequestBeginPicture(VADriverContextP context, VAContextID context_id,
 	if (surface_object == NULL)
 		return VA_STATUS_ERROR_INVALID_SURFACE;
 
-	if (surface_object->status == VASurfaceRendering)
-		RequestSyncSurface(context, surface_id);
+	pthread_mutex_lock(&context_object->mutex);
 
-	surface_object->status = VASurfaceRendering;
+	if (surface_status(surface_object) == VASurfaceRendering) {
+		pthread_mutex_lock(&driver_data->queue_mutex);
+		surface_sync(driver_data, context_object, surface_object);
+		pthread_mutex_unlock(&driver_data->queue_mutex);
+	}
+
+	/* The surface data is still mapped by a LockSurface user. */
+	if (__atomic_load_n(&surface_object->lock_count, __ATOMIC_ACQUIRE) > 0) {
+		status = VA_STATUS_ERROR_SURFACE_BUSY;
+		goto complete;
+	}
+
+	surface_object->params = &context_object->params;
+	surface_object->detiled_valid = false;
+	surface_set_status(surface_object, VASurfaceRendering);
 	context_object->render_surface_id = surface_id;
+	context_object->render_thread = pthread_self();
 
-	return VA_STATUS_SUCCESS;
+	status = VA_STATUS_SUCCESS;
+
+complete:
+	pthread_mutex_unlock(&context_object->mutex);
+
+	return status;
 }
 
 VAStatus RequestRenderPicture(VADriverContextP context, VAContextID context_id,
@@ -234,7 +585,7 @@ VAStatus RequestRenderPicture(VADriverContextP context, VAContextID context_id,
 	struct object_config *config_object;
 	struct object_surface *surface_object;
 	struct object_buffer *buffer_object;
-	int rc;
+	VAStatus status;
 	int i;
 
 	context_object = CONTEXT(driver_data, context_id);
@@ -245,23 +596,35 @@ VAStatus RequestRenderPicture(VADriverContextP context, VAContextID context_id,
 	if (config_object == NULL)
 		return VA_STATUS_ERROR_INVALID_CONFIG;
 
+	pthread_mutex_lock(&context_object->mutex);
+
 	surface_object =
 		SURFACE(driver_data, context_object->render_surface_id);
-	if (surface_object == NULL)
-		return VA_STATUS_ERROR_INVALID_SURFACE;
+	if (surface_object == NULL) {
+		status = VA_STATUS_ERROR_INVALID_SURFACE;
+		goto complete;
+	}
 
 	for (i = 0; i < buffers_count; i++) {
 		buffer_object = BUFFER(driver_data, buffers_ids[i]);
-		if (buffer_object == NULL)
-			return VA_STATUS_ERROR_INVALID_BUFFER;
+		if (buffer_object == NULL) {
+			status = VA_STATUS_ERROR_INVALID_BUFFER;
+			goto complete;
+		}
 
-		rc = codec_store_buffer(driver_data, config_object->profile,
-					surface_object, buffer_object);
-		if (rc != VA_STATUS_SUCCESS)
-			return rc;
+		status = codec_store_buffer(driver_data, context_object,
+					    config_object->profile,
+					    surface_object, buffer_object);
+		if (status != VA_STATUS_SUCCESS)
+			goto complete;
 	}
 
-	return VA_STATUS_SUCCESS;
+	status = VA_STATUS_SUCCESS;
+
+complete:
+	pthread_mutex_unlock(&context_object->mutex);
+
+	return status;
 }
 
 VAStatus RequestEndPicture(VADriverContextP context, VAContextID context_id)
@@ -272,6 +635,8 @@ VAStatus RequestEndPicture(VADriverContextP context, VAContextID context_id)
 	struct object_surface *surface_object;
 	struct video_format *video_format;
 	unsigned int output_type, capture_type;
+	unsigned int flags;
+	bool hold_capture;
 	int request_fd;
 	VAStatus status;
 	int rc;
@@ -291,47 +656,98 @@ VAStatus RequestEndPicture(VADriverContextP context, VAContextID context_id)
 	if (config_object == NULL)
 		return VA_STATUS_ERROR_INVALID_CONFIG;
 
+	pthread_mutex_lock(&context_object->mutex);
+
 	surface_object =
 		SURFACE(driver_data, context_object->render_surface_id);
-	if (surface_object == NULL)
-		return VA_STATUS_ERROR_INVALID_SURFACE;
+	if (surface_object == NULL) {
+		status = VA_STATUS_ERROR_INVALID_SURFACE;
+		goto complete;
+	}
+
+	/*
+	 * Both fields of a pair go to the same capture buffer, which the
+	 * decoder keeps as long as the timestamp does not change. Without
+	 * hold support, the buffer came back after the first field and is
+	 * queued again under the same timestamp.
+	 */
+	if (!surface_object->capture_held)
+		context_stamp_surface(context_object, surface_object);
 
-	gettimeofday(&surface_object->timestamp, NULL);
+	hold_capture = codec_hold_capture(config_object->profile,
+					  surface_object);
 
 	request_fd = surface_object->request_fd;
 	if (request_fd < 0) {
 		request_fd = media_request_alloc(driver_data->media_fd);
-		if (request_fd < 0)
-			return VA_STATUS_ERROR_OPERATION_FAILED;
+		if (request_fd < 0) {
+			status = VA_STATUS_ERROR_OPERATION_FAILED;
+			goto complete;
+		}
 
 		surface_object->request_fd = request_fd;
 	}
 
-	rc = codec_set_controls(driver_data, context_object,
-				config_object->profile, surface_object);
-	if (rc != VA_STATUS_SUCCESS)
-		return rc;
+	status = codec_set_controls(driver_data, context_object,
+				    config_object->profile, surface_object);
+	if (status != VA_STATUS_SUCCESS)
+		goto complete;
+
+	pthread_mutex_lock(&driver_data->queue_mutex);
+
+	if (!surface_object->capture_held ||
+	    !context_object->hold_capture_supported) {
+		rc = v4l2_queue_buffer(driver_data->video_fd, -1, capture_type,
+				       NULL, surface_object->destination_index,
+				       0, 0,
+				       surface_object->destination_buffers_count);
+		if (rc < 0) {
+			status = VA_STATUS_ERROR_OPERATION_FAILED;
+			goto unlock;
+		}
+	}
 
-	rc = v4l2_queue_buffer(driver_data->video_fd, -1, capture_type, NULL,
-			       surface_object->destination_index, 0,
-			       surface_object->destination_buffers_count);
-	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+	flags = hold_capture && context_object->hold_capture_supported ?
+		V4L2_BUF_FLAG_M2M_HOLD_CAPTURE_BUF : 0;
+
+	if (context_object->h264_slice_based &&
+	    surface_object->params->h264.slices_count > 1)
+		rc = h264_queue_slices(driver_data, context_object,
+				       surface_object, hold_capture);
+	else if (context_object->h265_slice_based &&
+		 surface_object->params->h265.slices_count > 1)
+		rc = h265_queue_slices(driver_data, context_object,
+				       surface_object, hold_capture);
+	else
+		rc = v4l2_queue_buffer(driver_data->video_fd, request_fd,
+				       output_type, &surface_object->timestamp,
+				       surface_object->source_index,
+				       surface_object->slices_size, flags, 1);
+	if (rc < 0) {
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto unlock;
+	}
 
-	rc = v4l2_queue_buffer(driver_data->video_fd, request_fd, output_type,
-			       &surface_object->timestamp,
-			       surface_object->source_index,
-			       surface_object->slices_size, 1);
-	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+	if (surface_object->slices_size > context_object->source_size_peak)
+		context_object->source_size_peak = surface_object->slices_size;
 
 	surface_object->slices_size = 0;
+	surface_object->capture_held = hold_capture;
 
-	status = RequestSyncSurface(context, context_object->render_surface_id);
-	if (status != VA_STATUS_SUCCESS)
-		return status;
+	status = surface_sync(driver_data, context_object, surface_object);
+
+unlock:
+	pthread_mutex_unlock(&driver_data->queue_mutex);
+
+complete:
+	codec_end_picture(config_object->profile, context_object,
+			  status == VA_STATUS_SUCCESS);
 
+	/* Threads syncing the surface are waiting for it to be submitted. */
 	context_object->render_surface_id = VA_INVALID_ID;
+	pthread_cond_broadcast(&context_object->picture_done);
 
-	return VA_STATUS_SUCCESS;
+	pthread_mutex_unlock(&context_object->mutex);
+
+	return status;
 }
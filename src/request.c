@@ -27,6 +27,7 @@
 #include "buffer.h"
 #include "config.h"
 #include "context.h"
+#include "dma_heap.h"
 #include "image.h"
 #include "picture.h"
 #include "subpicture.h"
@@ -54,10 +55,40 @@
 
 #include <linux/videodev2.h>
 
+#include <av1-ctrls.h>
+
 /* Set default visibility for the init function only. */
 VAStatus __attribute__((visibility("default")))
 VA_DRIVER_INIT_FUNC(VADriverContextP context);
 
+/*
+ * Stateless H264 and HEVC decoders take slices either as raw NAL units or
+ * prefixed with an Annex B start code. Raw NAL units are what VA provides,
+ * so they are preferred when the decoder supports them. Decoders without the
+ * control predate it and take raw NAL units.
+ */
+static bool request_annex_b(int video_fd, unsigned int id, int none,
+			    int annex_b)
+{
+	int value;
+	int rc;
+
+	if (v4l2_query_menu(video_fd, id, none))
+		value = none;
+	else if (v4l2_query_menu(video_fd, id, annex_b))
+		value = annex_b;
+	else
+		return false;
+
+	v4l2_set_control_value(video_fd, id, value);
+
+	rc = v4l2_get_control(video_fd, id, &value);
+	if (rc < 0)
+		return false;
+
+	return value == annex_b;
+}
+
 VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 {
 	struct request_data *driver_data;
@@ -69,6 +100,8 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 	int media_fd = -1;
 	char *video_path;
 	char *media_path;
+	char *export_mode;
+	char *dma_heap_path;
 	int rc;
 
 	context->version_major = VA_MAJOR_VERSION;
@@ -147,7 +180,18 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 	object_heap_init(&driver_data->image_heap, sizeof(struct object_image),
 			 IMAGE_ID_OFFSET);
 
-	unsigned int codecs[] = { V4L2_PIX_FMT_HEVC_SLICE, V4L2_PIX_FMT_H264_SLICE };
+	pthread_mutex_init(&driver_data->queue_mutex, NULL);
+
+	unsigned int codecs[] = {
+		V4L2_PIX_FMT_HEVC_SLICE,
+		V4L2_PIX_FMT_H264_SLICE,
+#if VA_CHECK_VERSION(1, 8, 0)
+		V4L2_PIX_FMT_AV1_FRAME,
+#endif
+		V4L2_PIX_FMT_VP9_FRAME,
+		V4L2_PIX_FMT_VP8_FRAME,
+		V4L2_PIX_FMT_MPEG2_SLICE,
+	};
 	unsigned int selected_pixfmt = 0;
 
 	video_path = getenv("LIBVA_V4L2_REQUEST_VIDEO_PATH");
@@ -155,7 +199,9 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 		video_fd = open(video_path, O_RDWR | O_NONBLOCK);
 		// Optionally: manually probe for codec here if you want to track selected_pixfmt
 	} else {
-		video_fd = v4l2_open_decoder(codecs, 2, &selected_pixfmt);
+		video_fd = v4l2_open_decoder(codecs,
+					     sizeof(codecs) / sizeof(codecs[0]),
+					     &selected_pixfmt);
 	}
 
 	if (video_fd < 0)
@@ -190,6 +236,28 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 
 	driver_data->video_fd = video_fd;
 	driver_data->media_fd = media_fd;
+	driver_data->dma_heap_fd = -1;
+
+	driver_data->h264_annex_b =
+		request_annex_b(video_fd, V4L2_CID_STATELESS_H264_START_CODE,
+				V4L2_STATELESS_H264_START_CODE_NONE,
+				V4L2_STATELESS_H264_START_CODE_ANNEX_B);
+	driver_data->h265_annex_b =
+		request_annex_b(video_fd, V4L2_CID_STATELESS_HEVC_START_CODE,
+				V4L2_STATELESS_HEVC_START_CODE_NONE,
+				V4L2_STATELESS_HEVC_START_CODE_ANNEX_B);
+
+	driver_data->av1_supported = v4l2_driver_is(video_fd, "hantro-vpu") ||
+				     v4l2_driver_is(video_fd, "visl");
+
+	export_mode = getenv("LIBVA_V4L2_REQUEST_EXPORT_LINEAR");
+	if (export_mode != NULL && strcmp(export_mode, "1") == 0) {
+		dma_heap_path = getenv("LIBVA_V4L2_REQUEST_DMA_HEAP_PATH");
+
+		driver_data->dma_heap_fd = dma_heap_open(dma_heap_path);
+		if (driver_data->dma_heap_fd >= 0)
+			driver_data->linear_export = true;
+	}
 
 	status = VA_STATUS_SUCCESS;
 	goto complete;
@@ -220,6 +288,9 @@ VAStatus RequestTerminate(VADriverContextP context)
 	close(driver_data->video_fd);
 	close(driver_data->media_fd);
 
+	if (driver_data->dma_heap_fd >= 0)
+		close(driver_data->dma_heap_fd);
+
 	/* Cleanup leftover buffers. */
 
 	image_object = (struct object_image *)
@@ -276,6 +347,8 @@ VAStatus RequestTerminate(VADriverContextP context)
 
 	object_heap_destroy(&driver_data->config_heap);
 
+	pthread_mutex_destroy(&driver_data->queue_mutex);
+
 	free(context->pDriverData);
 	context->pDriverData = NULL;
 
@@ -27,23 +27,26 @@
 #ifndef _V4L2_REQUEST_H_
 #define _V4L2_REQUEST_H_
 
+#include <pthread.h>
 #include <stdbool.h>
 
 #include "context.h"
 #include "object_heap.h"
 #include "video.h"
 #include <va/va.h>
+#include <va/va_drmcommon.h>
 
 #include <linux/videodev2.h>
 
 #define V4L2_REQUEST_STR_VENDOR			"v4l2-request"
 
-#define V4L2_REQUEST_MAX_PROFILES		11
+#define V4L2_REQUEST_MAX_PROFILES		15
 #define V4L2_REQUEST_MAX_ENTRYPOINTS		5
 #define V4L2_REQUEST_MAX_CONFIG_ATTRIBUTES	20
 #define V4L2_REQUEST_MAX_IMAGE_FORMATS		10
 #define V4L2_REQUEST_MAX_SUBPIC_FORMATS		4
 #define V4L2_REQUEST_MAX_DISPLAY_ATTRIBUTES	4
+#define V4L2_REQUEST_MAX_MODIFIERS		8
 
 struct request_data {
 	struct object_heap config_heap;
@@ -53,9 +56,34 @@ struct request_data {
 	struct object_heap image_heap;
 	int video_fd;
 	int media_fd;
+
+	/*
+	 * All contexts share the queues of video_fd. Buffers are matched to
+	 * their surface when dequeued, so a picture is queued and dequeued
+	 * with this lock held, taken after the context lock.
+	 */
+	pthread_mutex_t queue_mutex;
 	unsigned int codec_pixfmt;
 
+	/* Slices are passed with an Annex B start code rather than raw. */
+	bool h264_annex_b;
+	bool h265_annex_b;
+
+	/*
+	 * VA does not carry the AV1 refresh_frame_flags, so AV1 is only
+	 * exposed on drivers that track reference slots by timestamp.
+	 */
+	bool av1_supported;
+
 	struct video_format *video_format;
+
+	/* DRM modifiers of the capture formats the consumer can pick from. */
+	uint64_t modifiers[V4L2_REQUEST_MAX_MODIFIERS];
+	VADRMFormatModifierList modifiers_list;
+
+	/* Export tiled surfaces through linear shadow buffers. */
+	bool linear_export;
+	int dma_heap_fd;
 };
 
 VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context);
@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2026 libva-v4l2-request contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "scale.h"
+#include "tiled_yuv.h"
+
+/*
+ * Area averaging accumulates source rows in 16-bit lanes, which holds up to
+ * 256 rows of 8-bit samples. Taller boxes are decimated to that many rows.
+ */
+#define SCALE_AREA_ROWS_MAX	256
+
+/* Bilinear weights are 7-bit so that both factors fit an 8-bit multiply. */
+#define SCALE_WEIGHT_BITS	7
+#define SCALE_WEIGHT_ONE	(1 << SCALE_WEIGHT_BITS)
+
+static uint8_t *scale_source_row(struct scale_plane *plane,
+				 unsigned int components, unsigned int y,
+				 uint8_t *scratch)
+{
+	unsigned int x = plane->x * components;
+
+	y += plane->y;
+
+	if (plane->tiled) {
+		tiled_row_to_planar(plane->data, scratch, plane->pitch, x, y,
+				    plane->width * components);
+		return scratch;
+	}
+
+	return (uint8_t *)plane->data + y * plane->pitch + x;
+}
+
+/*
+ * Rows of a tiled destination are produced in the scratch buffer and written
+ * out by scale_destination_flush.
+ */
+static uint8_t *scale_destination_row(struct scale_plane *plane,
+				      unsigned int components, unsigned int y,
+				      uint8_t *scratch)
+{
+	if (plane->tiled)
+		return scratch;
+
+	return (uint8_t *)plane->data + (plane->y + y) * plane->pitch +
+	       plane->x * components;
+}
+
+static void scale_destination_flush(struct scale_plane *plane,
+				    unsigned int components, unsigned int y,
+				    uint8_t *row)
+{
+	if (!plane->tiled)
+		return;
+
+	planar_row_to_tiled(row, plane->data, plane->pitch,
+			    plane->x * components, plane->y + y,
+			    plane->width * components);
+}
+
+static void scale_accumulate_row(uint16_t *sums, const uint8_t *row,
+				 unsigned int size)
+{
+	unsigned int i = 0;
+
+#if defined(__ARM_NEON)
+	for (; i + 16 <= size; i += 16) {
+		uint8x16_t pixels = vld1q_u8(row + i);
+
+		vst1q_u16(sums + i, vaddw_u8(vld1q_u16(sums + i),
+					     vget_low_u8(pixels)));
+		vst1q_u16(sums + i + 8, vaddw_u8(vld1q_u16(sums + i + 8),
+						 vget_high_u8(pixels)));
+	}
+#elif defined(__SSE2__)
+	__m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i pixels = _mm_loadu_si128((const __m128i *)(row + i));
+		__m128i *low = (__m128i *)(sums + i);
+		__m128i *high = (__m128i *)(sums + i + 8);
+
+		_mm_storeu_si128(low, _mm_add_epi16(_mm_loadu_si128(low),
+				 _mm_unpacklo_epi8(pixels, zero)));
+		_mm_storeu_si128(high, _mm_add_epi16(_mm_loadu_si128(high),
+				 _mm_unpackhi_epi8(pixels, zero)));
+	}
+#endif
+
+	for (; i < size; i++)
+		sums[i] += row[i];
+}
+
+static void scale_blend_rows(uint8_t *dst, const uint8_t *top,
+			     const uint8_t *bottom, unsigned int weight,
+			     unsigned int size)
+{
+	unsigned int i = 0;
+
+#if defined(__ARM_NEON)
+	uint8x8_t top_weight = vdup_n_u8(SCALE_WEIGHT_ONE - weight);
+	uint8x8_t bottom_weight = vdup_n_u8(weight);
+
+	for (; i + 8 <= size; i += 8) {
+		uint16x8_t sum = vmull_u8(vld1_u8(top + i), top_weight);
+
+		sum = vmlal_u8(sum, vld1_u8(bottom + i), bottom_weight);
+		vst1_u8(dst + i, vrshrn_n_u16(sum, SCALE_WEIGHT_BITS));
+	}
+#elif defined(__SSE2__)
+	__m128i zero = _mm_setzero_si128();
+	__m128i top_weight = _mm_set1_epi16(SCALE_WEIGHT_ONE - weight);
+	__m128i bottom_weight = _mm_set1_epi16(weight);
+	__m128i rounding = _mm_set1_epi16(SCALE_WEIGHT_ONE / 2);
+
+	for (; i + 8 <= size; i += 8) {
+		__m128i a = _mm_loadl_epi64((const __m128i *)(top + i));
+		__m128i b = _mm_loadl_epi64((const __m128i *)(bottom + i));
+		__m128i sum;
+
+		a = _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), top_weight);
+		b = _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), bottom_weight);
+		sum = _mm_add_epi16(_mm_add_epi16(a, b), rounding);
+		sum = _mm_srli_epi16(sum, SCALE_WEIGHT_BITS);
+		_mm_storel_epi64((__m128i *)(dst + i),
+				 _mm_packus_epi16(sum, zero));
+	}
+#endif
+
+	for (; i < size; i++)
+		dst[i] = (top[i] * (SCALE_WEIGHT_ONE - weight) +
+			  bottom[i] * weight + SCALE_WEIGHT_ONE / 2) >>
+			 SCALE_WEIGHT_BITS;
+}
+
+/*
+ * Maps destination position i to a source position in 1/SCALE_WEIGHT_ONE
+ * units, aligning pixel centers.
+ */
+static unsigned int scale_bilinear_position(unsigned int i,
+					    unsigned int src_size,
+					    unsigned int dst_size)
+{
+	int64_t position;
+
+	position = ((2 * (int64_t)i + 1) * src_size * SCALE_WEIGHT_ONE) /
+		   (2 * (int64_t)dst_size) - SCALE_WEIGHT_ONE / 2;
+	if (position < 0)
+		position = 0;
+
+	if (position > (int64_t)(src_size - 1) * SCALE_WEIGHT_ONE)
+		position = (int64_t)(src_size - 1) * SCALE_WEIGHT_ONE;
+
+	return position;
+}
+
+static int scale_copy(struct scale_plane *src, struct scale_plane *dst,
+		      unsigned int components)
+{
+	unsigned int size = src->width * components;
+	uint8_t *scratch = NULL;
+	uint8_t *row;
+	unsigned int y;
+
+	if (src->tiled && dst->tiled) {
+		scratch = malloc(size);
+		if (scratch == NULL)
+			return -1;
+	}
+
+	for (y = 0; y < dst->height; y++) {
+		if (dst->tiled) {
+			row = scale_source_row(src, components, y, scratch);
+			planar_row_to_tiled(row, dst->data, dst->pitch,
+					    dst->x * components, dst->y + y,
+					    size);
+		} else if (src->tiled) {
+			row = scale_destination_row(dst, components, y, NULL);
+			tiled_row_to_planar(src->data, row, src->pitch,
+					    src->x * components, src->y + y,
+					    size);
+		} else {
+			row = scale_destination_row(dst, components, y, NULL);
+			memcpy(row, scale_source_row(src, components, y, NULL),
+			       size);
+		}
+	}
+
+	free(scratch);
+
+	return 0;
+}
+
+static int scale_area(struct scale_plane *src, struct scale_plane *dst,
+		      unsigned int components)
+{
+	unsigned int size = src->width * components;
+	unsigned int *offsets;
+	uint16_t *sums;
+	uint8_t *scratch = NULL;
+	uint8_t *output = NULL;
+	uint8_t *row;
+	unsigned int start, end, step, count, rows;
+	unsigned int sum;
+	unsigned int i, j, x, y;
+	int rc = -1;
+
+	offsets = malloc((dst->width + 1) * sizeof(*offsets));
+	sums = malloc(size * sizeof(*sums));
+	if (src->tiled)
+		scratch = malloc(size);
+	if (dst->tiled)
+		output = malloc(dst->width * components);
+
+	if (offsets == NULL || sums == NULL ||
+	    (src->tiled && scratch == NULL) || (dst->tiled && output == NULL))
+		goto complete;
+
+	for (i = 0; i <= dst->width; i++)
+		offsets[i] = (uint64_t)i * src->width / dst->width;
+
+	for (y = 0; y < dst->height; y++) {
+		start = (uint64_t)y * src->height / dst->height;
+		end = (uint64_t)(y + 1) * src->height / dst->height;
+		step = (end - start + SCALE_AREA_ROWS_MAX - 1) /
+		       SCALE_AREA_ROWS_MAX;
+
+		memset(sums, 0, size * sizeof(*sums));
+		rows = 0;
+
+		for (j = start; j < end; j += step) {
+			scale_accumulate_row(sums, scale_source_row(src,
+					     components, j, scratch), size);
+			rows++;
+		}
+
+		row = scale_destination_row(dst, components, y, output);
+
+		for (i = 0; i < dst->width; i++) {
+			count = (offsets[i + 1] - offsets[i]) * rows;
+
+			for (j = 0; j < components; j++) {
+				sum = 0;
+
+				for (x = offsets[i]; x < offsets[i + 1]; x++)
+					sum += sums[x * components + j];
+
+				row[i * components + j] =
+					(sum + count / 2) / count;
+			}
+		}
+
+		scale_destination_flush(dst, components, y, row);
+	}
+
+	rc = 0;
+
+complete:
+	free(output);
+	free(scratch);
+	free(sums);
+	free(offsets);
+
+	return rc;
+}
+
+static int scale_bilinear(struct scale_plane *src, struct scale_plane *dst,
+			  unsigned int components)
+{
+	unsigned int size = src->width * components;
+	unsigned int *positions;
+	uint8_t *scratch = NULL;
+	uint8_t *output = NULL;
+	uint8_t *blend;
+	uint8_t *top, *bottom, *line, *row;
+	unsigned int position, weight, x0, x1;
+	unsigned int i, j, y, y0, y1;
+	int rc = -1;
+
+	positions = malloc(dst->width * sizeof(*positions));
+	blend = malloc(size);
+	if (src->tiled)
+		scratch = malloc(size * 2);
+	if (dst->tiled)
+		output = malloc(dst->width * components);
+
+	if (positions == NULL || blend == NULL ||
+	    (src->tiled && scratch == NULL) || (dst->tiled && output == NULL))
+		goto complete;
+
+	for (i = 0; i < dst->width; i++)
+		positions[i] = scale_bilinear_position(i, src->width,
+						       dst->width);
+
+	for (y = 0; y < dst->height; y++) {
+		position = scale_bilinear_position(y, src->height,
+						   dst->height);
+		y0 = position >> SCALE_WEIGHT_BITS;
+		y1 = y0 + 1 < src->height ? y0 + 1 : y0;
+		weight = position & (SCALE_WEIGHT_ONE - 1);
+
+		top = scale_source_row(src, components, y0, scratch);
+
+		if (weight > 0) {
+			bottom = scale_source_row(src, components, y1,
+						  scratch != NULL ?
+						  scratch + size : NULL);
+			scale_blend_rows(blend, top, bottom, weight, size);
+			line = blend;
+		} else {
+			line = top;
+		}
+
+		row = scale_destination_row(dst, components, y, output);
+
+		for (i = 0; i < dst->width; i++) {
+			x0 = positions[i] >> SCALE_WEIGHT_BITS;
+			x1 = x0 + 1 < src->width ? x0 + 1 : x0;
+			weight = positions[i] & (SCALE_WEIGHT_ONE - 1);
+
+			for (j = 0; j < components; j++)
+				row[i * components + j] =
+					(line[x0 * components + j] *
+					 (SCALE_WEIGHT_ONE - weight) +
+					 line[x1 * components + j] * weight +
+					 SCALE_WEIGHT_ONE / 2) >>
+					SCALE_WEIGHT_BITS;
+		}
+
+		scale_destination_flush(dst, components, y, row);
+	}
+
+	rc = 0;
+
+complete:
+	free(output);
+	free(scratch);
+	free(blend);
+	free(positions);
+
+	return rc;
+}
+
+int scale_plane(struct scale_plane *src, struct scale_plane *dst,
+		unsigned int components)
+{
+	if (src->width == 0 || src->height == 0 || dst->width == 0 ||
+	    dst->height == 0)
+		return -1;
+
+	if (src->width == dst->width && src->height == dst->height)
+		return scale_copy(src, dst, components);
+
+	/* Reads every source row once, but only those within the rectangle. */
+	if (src->width >= dst->width && src->height >= dst->height)
+		return scale_area(src, dst, components);
+
+	return scale_bilinear(src, dst, components);
+}
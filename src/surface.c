@@ -24,7 +24,9 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include "config.h"
 #include "request.h"
+#include "context.h"
 #include "surface.h"
 
 #include <assert.h>
@@ -41,11 +43,73 @@
 #include <drm_fourcc.h>
 #include <linux/videodev2.h>
 
+#include "dma_heap.h"
 #include "media.h"
+#include "tiled_yuv.h"
 #include "utils.h"
 #include "v4l2.h"
 #include "video.h"
 
+static bool format_supported(struct request_data *driver_data,
+			     struct video_format *video_format)
+{
+	unsigned int capture_type;
+
+	capture_type = v4l2_type_video_capture(video_format->v4l2_mplane);
+
+	return v4l2_find_format(driver_data->video_fd, capture_type,
+				video_format->v4l2_format);
+}
+
+/*
+ * Without a modifier list from the consumer, the first supported format of
+ * the table is used, which favors linear formats for CPU access. Otherwise,
+ * the consumer's modifiers are tried in the order it gave them. Compressed
+ * formats are only used when the consumer asks for them.
+ */
+static struct video_format *select_format(struct request_data *driver_data,
+					  VADRMFormatModifierList *modifiers,
+					  unsigned int bit_depth)
+{
+	struct video_format *video_format;
+	unsigned int i, j;
+
+	if (modifiers == NULL || modifiers->num_modifiers == 0) {
+		for (i = 0; (video_format = video_format_get(i)) != NULL; i++)
+			if (video_format->bit_depth == bit_depth &&
+			    !video_format_is_compressed(video_format) &&
+			    format_supported(driver_data, video_format))
+				return video_format;
+
+		return NULL;
+	}
+
+	for (i = 0; i < modifiers->num_modifiers; i++)
+		for (j = 0; (video_format = video_format_get(j)) != NULL; j++)
+			if (video_format->bit_depth == bit_depth &&
+			    video_format->drm_modifier ==
+			    modifiers->modifiers[i] &&
+			    format_supported(driver_data, video_format))
+				return video_format;
+
+	return NULL;
+}
+
+static bool format_in_modifiers(struct video_format *video_format,
+				VADRMFormatModifierList *modifiers)
+{
+	unsigned int i;
+
+	if (modifiers == NULL || modifiers->num_modifiers == 0)
+		return true;
+
+	for (i = 0; i < modifiers->num_modifiers; i++)
+		if (modifiers->modifiers[i] == video_format->drm_modifier)
+			return true;
+
+	return false;
+}
+
 VAStatus RequestCreateSurfaces2(VADriverContextP context, unsigned int format,
 				unsigned int width, unsigned int height,
 				VASurfaceID *surfaces_ids,
@@ -56,39 +120,64 @@ VAStatus RequestCreateSurfaces2(VADriverContextP context, unsigned int format,
 	struct request_data *driver_data = context->pDriverData;
 	struct object_surface *surface_object;
 	struct video_format *video_format = NULL;
+	VADRMFormatModifierList *modifiers = NULL;
 	unsigned int destination_sizes[VIDEO_MAX_PLANES];
 	unsigned int destination_bytesperlines[VIDEO_MAX_PLANES];
 	unsigned int destination_planes_count;
+	unsigned int buffer_offsets[VIDEO_MAX_PLANES];
+	struct video_format_plane *plane;
+	unsigned int plane_size;
+	unsigned int buffer;
 	unsigned int format_width, format_height;
 	unsigned int capture_type;
 	unsigned int index_base;
 	unsigned int index;
 	unsigned int i, j;
+	unsigned int bit_depth;
+	int iterator;
 	VASurfaceID id;
-	bool found;
 	int rc;
 
-	if (format != VA_RT_FORMAT_YUV420)
+	switch (format) {
+	case VA_RT_FORMAT_YUV420:
+		bit_depth = 8;
+		break;
+
+	case VA_RT_FORMAT_YUV420_10:
+		bit_depth = 10;
+		break;
+
+	default:
 		return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+	}
 
+	for (i = 0; i < attributes_count; i++)
+		if (attributes[i].type == VASurfaceAttribDRMFormatModifiers &&
+		    attributes[i].value.type == VAGenericValueTypePointer)
+			modifiers = attributes[i].value.value.p;
 
-        if (!driver_data->video_format) {
-		found = v4l2_find_format(driver_data->video_fd,
-					 V4L2_BUF_TYPE_VIDEO_CAPTURE,
-					 V4L2_PIX_FMT_SUNXI_TILED_NV12);
-		if (found)
-			video_format = video_format_find(V4L2_PIX_FMT_SUNXI_TILED_NV12);
+	/* The capture format can only change while no surface uses it. */
+	if (driver_data->video_format != NULL &&
+	    driver_data->video_format->bit_depth != bit_depth &&
+	    object_heap_first(&driver_data->surface_heap, &iterator) == NULL)
+		driver_data->video_format = NULL;
 
-		found = v4l2_find_format(driver_data->video_fd,
-					 V4L2_BUF_TYPE_VIDEO_CAPTURE,
-					 V4L2_PIX_FMT_NV12);
-		if (found)
-			video_format = video_format_find(V4L2_PIX_FMT_NV12);
+	if (!driver_data->video_format) {
+		/*
+		 * Some drivers only list 10-bit capture formats once the
+		 * stream is known to be 10-bit.
+		 */
+		rc = config_set_bit_depth(driver_data, driver_data->codec_pixfmt,
+					  bit_depth, width, height);
+		if (rc < 0)
+			request_log("Unable to set up %u-bit decoding\n",
+				    bit_depth);
 
+		video_format = select_format(driver_data, modifiers, bit_depth);
 		if (video_format == NULL)
-			return VA_STATUS_ERROR_OPERATION_FAILED;
-
-		driver_data->video_format = video_format;
+			return modifiers != NULL ?
+			       VA_STATUS_ERROR_ATTR_NOT_SUPPORTED :
+			       VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
 
 		capture_type = v4l2_type_video_capture(video_format->v4l2_mplane);
 
@@ -96,9 +185,18 @@ VAStatus RequestCreateSurfaces2(VADriverContextP context, unsigned int format,
 				     video_format->v4l2_format, width, height);
 		if (rc < 0)
 			return VA_STATUS_ERROR_OPERATION_FAILED;
-        } else {
+
+		driver_data->video_format = video_format;
+	} else {
 		video_format = driver_data->video_format;
 		capture_type = v4l2_type_video_capture(video_format->v4l2_mplane);
+
+		/* The capture format is shared by all the surfaces. */
+		if (video_format->bit_depth != bit_depth)
+			return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+
+		if (!format_in_modifiers(video_format, modifiers))
+			return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
 	}
 
 	rc = v4l2_get_format(driver_data->video_fd, capture_type, &format_width,
@@ -110,7 +208,7 @@ VAStatus RequestCreateSurfaces2(VADriverContextP context, unsigned int format,
 	destination_planes_count = video_format->planes_count;
 
 	rc = v4l2_create_buffers(driver_data->video_fd, capture_type,
-				 surfaces_count, &index_base);
+				 surfaces_count, 0, &index_base, NULL);
 	if (rc < 0)
 		return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
@@ -143,44 +241,41 @@ VAStatus RequestCreateSurfaces2(VADriverContextP context, unsigned int format,
 		}
 
 		/*
-		 * FIXME: Handle this per-pixelformat, trying to generalize it
-		 * is not a reasonable approach. The final description should be
-		 * in terms of (logical) planes.
+		 * Logical planes are laid out one after the other within the
+		 * buffer they belong to, with the pitch of that buffer.
 		 */
 
-		if (video_format->v4l2_buffers_count == 1) {
-			destination_sizes[0] = destination_bytesperlines[0] *
-					       format_height;
-
-			for (j = 1; j < destination_planes_count; j++)
-				destination_sizes[j] = destination_sizes[0] / 2;
-
-			for (j = 0; j < destination_planes_count; j++) {
-				surface_object->destination_offsets[j] =
-					j > 0 ? destination_sizes[j - 1] : 0;
-				surface_object->destination_data[j] =
-					((unsigned char *)surface_object->destination_map[0] +
-					 surface_object->destination_offsets[j]);
-				surface_object->destination_sizes[j] =
-					destination_sizes[j];
-				surface_object->destination_bytesperlines[j] =
-					destination_bytesperlines[0];
-			}
-		} else if (video_format->v4l2_buffers_count == destination_planes_count) {
-			for (j = 0; j < destination_planes_count; j++) {
-				surface_object->destination_offsets[j] = 0;
-				surface_object->destination_data[j] =
-					surface_object->destination_map[j];
-				surface_object->destination_sizes[j] =
-					destination_sizes[j];
-				surface_object->destination_bytesperlines[j] =
-					destination_bytesperlines[j];
-			}
-		} else {
-			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+		memset(buffer_offsets, 0, sizeof(buffer_offsets));
+
+		for (j = 0; j < destination_planes_count; j++) {
+			plane = &video_format->planes[j];
+			buffer = plane->buffer;
+
+			/* Compressed data only has a meaningful total size. */
+			if (video_format->compressed)
+				plane_size = destination_sizes[buffer];
+			else
+				plane_size = destination_bytesperlines[buffer] *
+					     format_height /
+					     plane->vertical_subsampling;
+
+			if (buffer_offsets[buffer] + plane_size >
+			    surface_object->destination_map_lengths[buffer])
+				return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+			surface_object->destination_offsets[j] =
+				buffer_offsets[buffer];
+			surface_object->destination_data[j] =
+				(unsigned char *)surface_object->destination_map[buffer] +
+				buffer_offsets[buffer];
+			surface_object->destination_sizes[j] = plane_size;
+			surface_object->destination_bytesperlines[j] =
+				destination_bytesperlines[buffer];
+
+			buffer_offsets[buffer] += plane_size;
 		}
 
-		surface_object->status = VASurfaceReady;
+		surface_set_status(surface_object, VASurfaceReady);
 		surface_object->width = width;
 		surface_object->height = height;
 
@@ -195,13 +290,23 @@ VAStatus RequestCreateSurfaces2(VADriverContextP context, unsigned int format,
 		surface_object->destination_buffers_count =
 			video_format->v4l2_buffers_count;
 
-		memset(&surface_object->params, 0,
-		       sizeof(surface_object->params));
+		surface_object->params = NULL;
 		surface_object->slices_count = 0;
 		surface_object->slices_size = 0;
 
 		surface_object->request_fd = -1;
 
+		surface_object->detiled_data = NULL;
+		surface_object->detiled_size = 0;
+		surface_object->detiled_fd = -1;
+		surface_object->detiled_valid = false;
+		surface_object->lock_count = 0;
+		surface_object->capture_held = false;
+		surface_object->request_queued = false;
+		surface_object->sequence = 0;
+		surface_object->order_hint = 0;
+		surface_object->context_id = VA_INVALID_ID;
+
 		surfaces_ids[i] = id;
 	}
 
@@ -242,6 +347,14 @@ VAStatus RequestDestroySurfaces(VADriverContextP context,
 		if (surface_object->request_fd > 0)
 			close(surface_object->request_fd);
 
+		if (surface_object->detiled_fd >= 0) {
+			munmap(surface_object->detiled_data,
+			       surface_object->detiled_size);
+			close(surface_object->detiled_fd);
+		} else if (surface_object->detiled_data != NULL) {
+			free(surface_object->detiled_data);
+		}
+
 		object_heap_free(&driver_data->surface_heap,
 				 (struct object_base *)surface_object);
 	}
@@ -249,10 +362,95 @@ VAStatus RequestDestroySurfaces(VADriverContextP context,
 	return VA_STATUS_SUCCESS;
 }
 
-VAStatus RequestSyncSurface(VADriverContextP context, VASurfaceID surface_id)
+static bool linear_export_needed(struct request_data *driver_data)
 {
-	struct request_data *driver_data = context->pDriverData;
-	struct object_surface *surface_object;
+	struct video_format *video_format = driver_data->video_format;
+
+	return driver_data->linear_export &&
+	       !video_format_is_linear(video_format) &&
+	       !video_format_is_compressed(video_format);
+}
+
+static VAStatus detile_surface(struct request_data *driver_data,
+				struct object_surface *surface_object)
+{
+	unsigned int size;
+	unsigned int offset;
+	unsigned int i;
+	void *data;
+	int fd;
+
+	if (surface_object->detiled_valid)
+		return VA_STATUS_SUCCESS;
+
+	size = 0;
+	for (i = 0; i < surface_object->destination_planes_count; i++)
+		size += surface_object->destination_sizes[i];
+
+	if (surface_object->detiled_data == NULL) {
+		if (driver_data->linear_export) {
+			fd = dma_heap_alloc(driver_data->dma_heap_fd, size);
+			if (fd < 0)
+				return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+			data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED, fd, 0);
+			if (data == MAP_FAILED) {
+				close(fd);
+				return VA_STATUS_ERROR_ALLOCATION_FAILED;
+			}
+
+			surface_object->detiled_fd = fd;
+		} else {
+			data = malloc(size);
+			if (data == NULL)
+				return VA_STATUS_ERROR_ALLOCATION_FAILED;
+		}
+
+		surface_object->detiled_data = data;
+		surface_object->detiled_size = size;
+	}
+
+	if (surface_object->detiled_fd >= 0)
+		dma_buf_sync(surface_object->detiled_fd, true);
+
+	offset = 0;
+
+	for (i = 0; i < surface_object->destination_planes_count; i++) {
+		if (video_format_is_linear(driver_data->video_format))
+			memcpy(surface_object->detiled_data + offset,
+			       surface_object->destination_data[i],
+			       surface_object->destination_sizes[i]);
+		else
+			tiled_to_planar(surface_object->destination_data[i],
+					surface_object->detiled_data + offset,
+					surface_object->destination_bytesperlines[i],
+					surface_object->width,
+					i == 0 ? surface_object->height :
+						 surface_object->height / 2);
+
+		offset += surface_object->destination_sizes[i];
+	}
+
+	if (surface_object->detiled_fd >= 0)
+		dma_buf_sync(surface_object->detiled_fd, false);
+
+	surface_object->detiled_valid = true;
+
+	return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Called with the context lock held, when there is a context, and with the
+ * queue lock held. Surfaces that were never a render target have nothing to
+ * sync.
+ */
+VAStatus surface_sync(struct request_data *driver_data,
+		      struct object_context *context_object,
+		      struct object_surface *surface_object)
+{
+	struct object_surface *completed_object;
+	struct timeval timestamp;
 	VAStatus status;
 	struct video_format *video_format;
 	unsigned int output_type, capture_type;
@@ -268,13 +466,7 @@ VAStatus RequestSyncSurface(VADriverContextP context, VASurfaceID surface_id)
 	output_type = v4l2_type_video_output(video_format->v4l2_mplane);
 	capture_type = v4l2_type_video_capture(video_format->v4l2_mplane);
 
-	surface_object = SURFACE(driver_data, surface_id);
-	if (surface_object == NULL) {
-		status = VA_STATUS_ERROR_INVALID_SURFACE;
-		goto error;
-	}
-
-	if (surface_object->status != VASurfaceRendering) {
+	if (surface_status(surface_object) != VASurfaceRendering) {
 		status = VA_STATUS_SUCCESS;
 		goto complete;
 	}
@@ -285,12 +477,16 @@ VAStatus RequestSyncSurface(VADriverContextP context, VASurfaceID surface_id)
 		goto error;
 	}
 
-	rc = media_request_queue(request_fd);
-	if (rc < 0) {
-		status = VA_STATUS_ERROR_OPERATION_FAILED;
-		goto error;
+	if (!surface_object->request_queued) {
+		rc = media_request_queue(request_fd);
+		if (rc < 0) {
+			status = VA_STATUS_ERROR_OPERATION_FAILED;
+			goto error;
+		}
 	}
 
+	surface_object->request_queued = false;
+
 	rc = media_request_wait_completion(request_fd);
 	if (rc < 0) {
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
@@ -304,21 +500,71 @@ VAStatus RequestSyncSurface(VADriverContextP context, VASurfaceID surface_id)
 	}
 
 	rc = v4l2_dequeue_buffer(driver_data->video_fd, -1, output_type,
-				 surface_object->source_index, 1);
+				 surface_object->source_index, 1, NULL);
 	if (rc < 0) {
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
 		goto error;
 	}
 
-	rc = v4l2_dequeue_buffer(driver_data->video_fd, -1, capture_type,
-				 surface_object->destination_index,
-				 surface_object->destination_buffers_count);
-	if (rc < 0) {
-		status = VA_STATUS_ERROR_OPERATION_FAILED;
-		goto error;
+	if (context_object != NULL) {
+		rc = context_complete_slices(driver_data, context_object);
+		if (rc < 0) {
+			status = VA_STATUS_ERROR_OPERATION_FAILED;
+			goto error;
+		}
+	}
+
+	/* The capture buffer only comes back with the second field. */
+	if (surface_object->capture_held && context_object != NULL &&
+	    context_object->hold_capture_supported) {
+		surface_set_status(surface_object, VASurfaceReady);
+		status = VA_STATUS_SUCCESS;
+		goto complete;
+	}
+
+	/*
+	 * A first field that never got its pair is released by the decoder
+	 * along with the next picture, so match completed buffers to their
+	 * surface through the timestamp. Buffers with a timestamp that is not
+	 * known to the context are not ours, so keep going until the one of
+	 * this surface comes back.
+	 */
+	for (;;) {
+		rc = v4l2_dequeue_buffer(driver_data->video_fd, -1,
+					 capture_type,
+					 surface_object->destination_index,
+					 surface_object->destination_buffers_count,
+					 &timestamp);
+		if (rc < 0) {
+			status = VA_STATUS_ERROR_OPERATION_FAILED;
+			goto error;
+		}
+
+		if (v4l2_timeval_to_ns(&timestamp) ==
+		    v4l2_timeval_to_ns(&surface_object->timestamp))
+			break;
+
+		completed_object = context_object != NULL ?
+			context_find_surface(driver_data, context_object,
+					     &timestamp) :
+			NULL;
+		if (completed_object == NULL ||
+		    completed_object == surface_object)
+			continue;
+
+		completed_object->capture_held = false;
+		surface_set_status(completed_object, VASurfaceDisplaying);
+		completed_object->detiled_valid = false;
 	}
 
-	surface_object->status = VASurfaceDisplaying;
+	surface_object->detiled_valid = false;
+	surface_set_status(surface_object, VASurfaceDisplaying);
+
+	/* Fill the linear shadow now so that exporting it is free. */
+	if (linear_export_needed(driver_data)) {
+		status = detile_surface(driver_data, surface_object);
+		goto complete;
+	}
 
 	status = VA_STATUS_SUCCESS;
 	goto complete;
@@ -333,6 +579,86 @@ complete:
 	return status;
 }
 
+/*
+ * Takes the lock of the context the surface is a render target of, if any,
+ * and syncs the surface with it held, so that its data is only touched once
+ * the decoder is done with it and not while another picture goes to it.
+ * A picture under construction on another thread is waited for, while the
+ * thread building it would wait for itself, so it gets an error instead.
+ */
+VAStatus surface_lock(struct request_data *driver_data,
+		      struct object_surface *surface_object,
+		      struct object_context **context_object)
+{
+	struct object_context *object;
+	VAStatus status;
+
+	object = CONTEXT(driver_data, surface_object->context_id);
+	if (object != NULL) {
+		pthread_mutex_lock(&object->mutex);
+
+		while (object->render_surface_id == surface_object->base.id) {
+			if (pthread_equal(object->render_thread,
+					  pthread_self())) {
+				request_log("Syncing surface %#x from its render thread\n",
+					    surface_object->base.id);
+				status = VA_STATUS_ERROR_SURFACE_BUSY;
+				goto error;
+			}
+
+			pthread_cond_wait(&object->picture_done,
+					  &object->mutex);
+		}
+	}
+
+	if (surface_status(surface_object) == VASurfaceRendering) {
+		pthread_mutex_lock(&driver_data->queue_mutex);
+		status = surface_sync(driver_data, object, surface_object);
+		pthread_mutex_unlock(&driver_data->queue_mutex);
+
+		if (status != VA_STATUS_SUCCESS)
+			goto error;
+	}
+
+	*context_object = object;
+
+	return VA_STATUS_SUCCESS;
+
+error:
+	surface_unlock(object);
+
+	return status;
+}
+
+void surface_unlock(struct object_context *context_object)
+{
+	if (context_object != NULL)
+		pthread_mutex_unlock(&context_object->mutex);
+}
+
+VAStatus RequestSyncSurface(VADriverContextP context, VASurfaceID surface_id)
+{
+	struct request_data *driver_data = context->pDriverData;
+	struct object_surface *surface_object;
+	struct object_context *context_object;
+	VAStatus status;
+
+	surface_object = SURFACE(driver_data, surface_id);
+	if (surface_object == NULL)
+		return VA_STATUS_ERROR_INVALID_SURFACE;
+
+	if (surface_status(surface_object) != VASurfaceRendering)
+		return VA_STATUS_SUCCESS;
+
+	status = surface_lock(driver_data, surface_object, &context_object);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
+
+	surface_unlock(context_object);
+
+	return VA_STATUS_SUCCESS;
+}
+
 VAStatus RequestQuerySurfaceAttributes(VADriverContextP context,
 				       VAConfigID config,
 				       VASurfaceAttrib *attributes,
@@ -342,8 +668,12 @@ VAStatus RequestQuerySurfaceAttributes(VADriverContextP context,
 	VASurfaceAttrib *attributes_list;
 	unsigned int attributes_list_size = V4L2_REQUEST_MAX_CONFIG_ATTRIBUTES *
 					    sizeof(*attributes);
+	struct object_config *config_object;
+	struct video_format *video_format;
+	unsigned int modifiers_count;
 	int memory_types;
 	unsigned int i = 0;
+	unsigned int j, k;
 
 	attributes_list = malloc(attributes_list_size);
 	memset(attributes_list, 0, attributes_list_size);
@@ -354,6 +684,17 @@ VAStatus RequestQuerySurfaceAttributes(VADriverContextP context,
 	attributes_list[i].value.value.i = VA_FOURCC_NV12;
 	i++;
 
+	config_object = CONFIG(driver_data, config);
+	if (config_object != NULL &&
+	    (config_object->attributes[0].value & VA_RT_FORMAT_YUV420_10)) {
+		attributes_list[i].type = VASurfaceAttribPixelFormat;
+		attributes_list[i].flags = VA_SURFACE_ATTRIB_GETTABLE |
+					   VA_SURFACE_ATTRIB_SETTABLE;
+		attributes_list[i].value.type = VAGenericValueTypeInteger;
+		attributes_list[i].value.value.i = VA_FOURCC_P010;
+		i++;
+	}
+
 	attributes_list[i].type = VASurfaceAttribMinWidth;
 	attributes_list[i].flags = VA_SURFACE_ATTRIB_GETTABLE;
 	attributes_list[i].value.type = VAGenericValueTypeInteger;
@@ -391,12 +732,49 @@ VAStatus RequestQuerySurfaceAttributes(VADriverContextP context,
 	 * that are required for supporting the tiled output format.
 	 */
 
-	if (video_format_is_linear(driver_data->video_format))
+	if (video_format_is_linear(driver_data->video_format) ||
+	    linear_export_needed(driver_data))
 		memory_types |= VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME;
 
 	attributes_list[i].value.value.i = memory_types;
 	i++;
 
+	/* Only the current format remains once surfaces were created. */
+	modifiers_count = 0;
+
+	if (driver_data->video_format != NULL) {
+		driver_data->modifiers[modifiers_count++] =
+			driver_data->video_format->drm_modifier;
+	} else {
+		for (j = 0; (video_format = video_format_get(j)) != NULL; j++) {
+			if (!format_supported(driver_data, video_format))
+				continue;
+
+			for (k = 0; k < modifiers_count; k++)
+				if (driver_data->modifiers[k] ==
+				    video_format->drm_modifier)
+					break;
+
+			if (k == modifiers_count &&
+			    modifiers_count < V4L2_REQUEST_MAX_MODIFIERS)
+				driver_data->modifiers[modifiers_count++] =
+					video_format->drm_modifier;
+		}
+	}
+
+	if (modifiers_count > 0) {
+		driver_data->modifiers_list.num_modifiers = modifiers_count;
+		driver_data->modifiers_list.modifiers = driver_data->modifiers;
+
+		attributes_list[i].type = VASurfaceAttribDRMFormatModifiers;
+		attributes_list[i].flags = VA_SURFACE_ATTRIB_GETTABLE |
+					   VA_SURFACE_ATTRIB_SETTABLE;
+		attributes_list[i].value.type = VAGenericValueTypePointer;
+		attributes_list[i].value.value.p =
+			&driver_data->modifiers_list;
+		i++;
+	}
+
 	attributes_list_size = i * sizeof(*attributes);
 
 	if (attributes != NULL)
@@ -420,7 +798,7 @@ VAStatus RequestQuerySurfaceStatus(VADriverContextP context,
 	if (surface_object == NULL)
 		return VA_STATUS_ERROR_INVALID_SURFACE;
 
-	*status = surface_object->status;
+	*status = surface_status(surface_object);
 
 	return VA_STATUS_SUCCESS;
 }
@@ -435,6 +813,58 @@ VAStatus RequestPutSurface(VADriverContextP context, VASurfaceID surface_id,
 	return VA_STATUS_ERROR_UNIMPLEMENTED;
 }
 
+static bool lock_uses_detiled(struct request_data *driver_data,
+			      struct object_surface *surface_object)
+{
+	return !video_format_is_linear(driver_data->video_format) ||
+	       surface_object->destination_buffers_count != 1;
+}
+
+/*
+ * Writes the linear copy handed out by LockSurface back to the capture
+ * buffer, so that CPU writes to it are not lost.
+ */
+static void retile_surface(struct request_data *driver_data,
+			   struct object_surface *surface_object)
+{
+	unsigned int pitch, height, width;
+	unsigned int offset;
+	unsigned int i, y;
+	void *src, *dst;
+
+	if (surface_object->detiled_fd >= 0)
+		dma_buf_sync(surface_object->detiled_fd, true);
+
+	offset = 0;
+
+	for (i = 0; i < surface_object->destination_planes_count; i++) {
+		if (video_format_is_linear(driver_data->video_format)) {
+			memcpy(surface_object->destination_data[i],
+			       surface_object->detiled_data + offset,
+			       surface_object->destination_sizes[i]);
+		} else {
+			pitch = surface_object->destination_bytesperlines[i];
+			width = surface_object->width;
+			height = i == 0 ? surface_object->height :
+					  surface_object->height / 2;
+
+			dst = surface_object->destination_data[i];
+
+			for (y = 0; y < height; y++) {
+				src = surface_object->detiled_data + offset +
+				      y * pitch;
+				planar_row_to_tiled(src, dst, (width + 31) & ~31,
+						    0, y, width);
+			}
+		}
+
+		offset += surface_object->destination_sizes[i];
+	}
+
+	if (surface_object->detiled_fd >= 0)
+		dma_buf_sync(surface_object->detiled_fd, false);
+}
+
 VAStatus RequestLockSurface(VADriverContextP context, VASurfaceID surface_id,
 			    unsigned int *fourcc, unsigned int *luma_stride,
 			    unsigned int *chroma_u_stride,
@@ -444,12 +874,216 @@ VAStatus RequestLockSurface(VADriverContextP context, VASurfaceID surface_id,
 			    unsigned int *chroma_v_offset,
 			    unsigned int *buffer_name, void **buffer)
 {
-	return VA_STATUS_ERROR_UNIMPLEMENTED;
+	struct request_data *driver_data = context->pDriverData;
+	struct object_surface *surface_object;
+	struct object_context *context_object;
+	unsigned int chroma_offset;
+	unsigned int sample_size;
+	void *data;
+	VAStatus status;
+
+	surface_object = SURFACE(driver_data, surface_id);
+	if (surface_object == NULL)
+		return VA_STATUS_ERROR_INVALID_SURFACE;
+
+	/*
+	 * Compressed and packed 10-bit surfaces cannot be accessed from the
+	 * CPU as plain planes.
+	 */
+	if (video_format_is_compressed(driver_data->video_format) ||
+	    driver_data->video_format->v4l2_format == V4L2_PIX_FMT_NV15)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	status = surface_lock(driver_data, surface_object, &context_object);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
+
+	/*
+	 * Linear single-buffer surfaces are handed out as they are mapped.
+	 * Other layouts get a linear copy that is kept around until the
+	 * surface is decoded to again.
+	 */
+	if (!lock_uses_detiled(driver_data, surface_object)) {
+		data = surface_object->destination_data[0];
+		chroma_offset = surface_object->destination_offsets[1];
+	} else {
+		status = detile_surface(driver_data, surface_object);
+		if (status != VA_STATUS_SUCCESS)
+			goto complete;
+
+		data = surface_object->detiled_data;
+		chroma_offset = surface_object->destination_sizes[0];
+	}
+
+	sample_size = driver_data->video_format->bit_depth > 8 ? 2 : 1;
+
+	*fourcc = sample_size > 1 ? VA_FOURCC_P010 : VA_FOURCC_NV12;
+	*luma_stride = surface_object->destination_bytesperlines[0];
+	*chroma_u_stride = surface_object->destination_bytesperlines[1];
+	*chroma_v_stride = surface_object->destination_bytesperlines[1];
+	*luma_offset = 0;
+	*chroma_u_offset = chroma_offset;
+	*chroma_v_offset = chroma_offset + sample_size;
+	*buffer_name = 0;
+	*buffer = data;
+
+	__atomic_add_fetch(&surface_object->lock_count, 1, __ATOMIC_ACQ_REL);
+
+	status = VA_STATUS_SUCCESS;
+
+complete:
+	surface_unlock(context_object);
+
+	return status;
 }
 
 VAStatus RequestUnlockSurface(VADriverContextP context, VASurfaceID surface_id)
 {
-	return VA_STATUS_ERROR_UNIMPLEMENTED;
+	struct request_data *driver_data = context->pDriverData;
+	struct object_surface *surface_object;
+	struct object_context *context_object;
+	unsigned int lock_count;
+	VAStatus status;
+
+	surface_object = SURFACE(driver_data, surface_id);
+	if (surface_object == NULL)
+		return VA_STATUS_ERROR_INVALID_SURFACE;
+
+	/* Keep BeginPicture off the surface until the copy is written back. */
+	status = surface_lock(driver_data, surface_object, &context_object);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
+
+	lock_count = __atomic_load_n(&surface_object->lock_count,
+				     __ATOMIC_ACQUIRE);
+
+	do {
+		if (lock_count == 0) {
+			status = VA_STATUS_ERROR_INVALID_PARAMETER;
+			goto complete;
+		}
+	} while (!__atomic_compare_exchange_n(&surface_object->lock_count,
+					      &lock_count, lock_count - 1,
+					      false, __ATOMIC_ACQ_REL,
+					      __ATOMIC_ACQUIRE));
+
+	if (lock_count == 1 && lock_uses_detiled(driver_data, surface_object))
+		retile_surface(driver_data, surface_object);
+
+	status = VA_STATUS_SUCCESS;
+
+complete:
+	surface_unlock(context_object);
+
+	return status;
+}
+
+/*
+ * Planes are described as a single composed layer, or as one layer per plane
+ * when the consumer asks for separate layers and the format allows it.
+ */
+static void export_fill_layers(VADRMPRIMESurfaceDescriptor *surface_descriptor,
+			       struct video_format *video_format,
+			       struct object_surface *surface_object,
+			       uint32_t flags, unsigned int *object_indexes,
+			       unsigned int *offsets)
+{
+	unsigned int planes_count = surface_object->destination_planes_count;
+	unsigned int i;
+
+	if ((flags & VA_EXPORT_SURFACE_SEPARATE_LAYERS) &&
+	    video_format->planes[0].drm_format != 0) {
+		surface_descriptor->num_layers = planes_count;
+
+		for (i = 0; i < planes_count; i++) {
+			surface_descriptor->layers[i].drm_format =
+				video_format->planes[i].drm_format;
+			surface_descriptor->layers[i].num_planes = 1;
+			surface_descriptor->layers[i].object_index[0] =
+				object_indexes[i];
+			surface_descriptor->layers[i].offset[0] = offsets[i];
+			surface_descriptor->layers[i].pitch[0] =
+				surface_object->destination_bytesperlines[i];
+		}
+
+		return;
+	}
+
+	surface_descriptor->num_layers = 1;
+
+	surface_descriptor->layers[0].drm_format = video_format->drm_format;
+	surface_descriptor->layers[0].num_planes = planes_count;
+
+	for (i = 0; i < planes_count; i++) {
+		surface_descriptor->layers[0].object_index[i] =
+			object_indexes[i];
+		surface_descriptor->layers[0].offset[i] = offsets[i];
+		surface_descriptor->layers[0].pitch[i] =
+			surface_object->destination_bytesperlines[i];
+	}
+}
+
+static VAStatus export_detiled_surface(VADriverContextP context,
+				       struct object_surface *surface_object,
+				       uint32_t flags,
+				       VADRMPRIMESurfaceDescriptor *surface_descriptor)
+{
+	struct request_data *driver_data = context->pDriverData;
+	struct video_format *video_format = driver_data->video_format;
+	struct object_context *context_object;
+	unsigned int object_indexes[VIDEO_MAX_PLANES];
+	unsigned int offsets[VIDEO_MAX_PLANES];
+	unsigned int planes_count;
+	unsigned int offset;
+	unsigned int i;
+	VAStatus status;
+	int fd;
+
+	status = surface_lock(driver_data, surface_object, &context_object);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
+
+	status = detile_surface(driver_data, surface_object);
+	if (status != VA_STATUS_SUCCESS)
+		goto complete;
+
+	fd = fcntl(surface_object->detiled_fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0) {
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto complete;
+	}
+
+	planes_count = surface_object->destination_planes_count;
+
+	surface_descriptor->fourcc = video_format->bit_depth > 8 ?
+				     VA_FOURCC_P010 : VA_FOURCC_NV12;
+	surface_descriptor->width = surface_object->width;
+	surface_descriptor->height = surface_object->height;
+	surface_descriptor->num_objects = 1;
+
+	surface_descriptor->objects[0].drm_format_modifier =
+		DRM_FORMAT_MOD_LINEAR;
+	surface_descriptor->objects[0].fd = fd;
+	surface_descriptor->objects[0].size = surface_object->detiled_size;
+
+	offset = 0;
+
+	for (i = 0; i < planes_count; i++) {
+		object_indexes[i] = 0;
+		offsets[i] = offset;
+
+		offset += surface_object->destination_sizes[i];
+	}
+
+	export_fill_layers(surface_descriptor, video_format, surface_object,
+			   flags, object_indexes, offsets);
+
+	status = VA_STATUS_SUCCESS;
+
+complete:
+	surface_unlock(context_object);
+
+	return status;
 }
 
 VAStatus RequestExportSurfaceHandle(VADriverContextP context,
@@ -460,11 +1094,12 @@ VAStatus RequestExportSurfaceHandle(VADriverContextP context,
 	VADRMPRIMESurfaceDescriptor *surface_descriptor = descriptor;
 	struct object_surface *surface_object;
 	struct video_format *video_format;
+	unsigned int object_indexes[VIDEO_MAX_PLANES];
+	unsigned int offsets[VIDEO_MAX_PLANES];
 	int *export_fds = NULL;
 	unsigned int export_fds_count;
 	unsigned int planes_count;
 	unsigned int capture_type;
-	unsigned int size;
 	unsigned int i;
 	VAStatus status;
 	int rc;
@@ -480,6 +1115,10 @@ VAStatus RequestExportSurfaceHandle(VADriverContextP context,
 	if (surface_object == NULL)
 		return VA_STATUS_ERROR_INVALID_SURFACE;
 
+	if (linear_export_needed(driver_data))
+		return export_detiled_surface(context, surface_object, flags,
+					      surface_descriptor);
+
 	export_fds_count = surface_object->destination_buffers_count;
 	export_fds = malloc(export_fds_count * sizeof(*export_fds));
 
@@ -495,40 +1134,29 @@ VAStatus RequestExportSurfaceHandle(VADriverContextP context,
 
 	planes_count = surface_object->destination_planes_count;
 
-	surface_descriptor->fourcc = VA_FOURCC_NV12;
+	surface_descriptor->fourcc = video_format->bit_depth > 8 ?
+				     VA_FOURCC_P010 : VA_FOURCC_NV12;
 	surface_descriptor->width = surface_object->width;
 	surface_descriptor->height = surface_object->height;
 	surface_descriptor->num_objects = export_fds_count;
 
-	size = 0;
-
-	if (export_fds_count == 1)
-		for (i = 0; i < planes_count; i++)
-			size += surface_object->destination_sizes[i];
-
+	/* Each V4L2 buffer is exported as its own object. */
 	for (i = 0; i < export_fds_count; i++) {
 		surface_descriptor->objects[i].drm_format_modifier =
 			video_format->drm_modifier;
 		surface_descriptor->objects[i].fd = export_fds[i];
-		surface_descriptor->objects[i].size = export_fds_count == 1 ?
-						      size :
-						      surface_object->destination_sizes[i];
+		surface_descriptor->objects[i].size =
+			surface_object->destination_map_lengths[i];
 	}
 
-	surface_descriptor->num_layers = 1;
-
-	surface_descriptor->layers[0].drm_format = video_format->drm_format;
-	surface_descriptor->layers[0].num_planes = planes_count;
-
 	for (i = 0; i < planes_count; i++) {
-		surface_descriptor->layers[0].object_index[i] =
-			export_fds_count == 1 ? 0 : i;
-		surface_descriptor->layers[0].offset[i] =
-			surface_object->destination_offsets[i];
-		surface_descriptor->layers[0].pitch[i] =
-			surface_object->destination_bytesperlines[i];
+		object_indexes[i] = video_format->planes[i].buffer;
+		offsets[i] = surface_object->destination_offsets[i];
 	}
 
+	export_fill_layers(surface_descriptor, video_format, surface_object,
+			   flags, object_indexes, offsets);
+
 	status = VA_STATUS_SUCCESS;
 	goto complete;
 
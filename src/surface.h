@@ -32,23 +32,100 @@
 #include <va/va_backend.h>
 
 #include "object_heap.h"
+#include "av1.h"
+#include "h264.h"
+#include "h265.h"
 
 #define SURFACE(data, id)                                                      \
 	((struct object_surface *)object_heap_lookup(&(data)->surface_heap, id))
 #define SURFACE_ID_OFFSET		0x04000000
 
+union surface_params {
+	struct {
+		VAPictureParameterBufferMPEG2 picture;
+		VAIQMatrixBufferMPEG2 iqmatrix;
+		bool iqmatrix_set;
+	} mpeg2;
+	struct {
+		VAIQMatrixBufferH264 matrix;
+		VAPictureParameterBufferH264 picture;
+		/* Slices are stored in the context, see h264_slices. */
+		unsigned int slices_count;
+		unsigned int slices_copied;
+	} h264;
+	struct {
+		VAPictureParameterBufferHEVC picture;
+		/* Slices and entry points are stored in the context. */
+		unsigned int slices_count;
+		unsigned int slices_copied;
+		unsigned int entry_points_count;
+		VAIQMatrixBufferHEVC iqmatrix;
+		bool iqmatrix_set;
+	} h265;
+	struct {
+		VAPictureParameterBufferVP8 picture;
+		VASliceParameterBufferVP8 slice;
+		VAProbabilityDataBufferVP8 probabilities;
+		VAIQMatrixBufferVP8 iqmatrix;
+	} vp8;
+	struct {
+		VADecPictureParameterBufferVP9 picture;
+	} vp9;
+#if VA_CHECK_VERSION(1, 8, 0)
+	struct {
+		VADecPictureParameterBufferAV1 picture;
+		struct av1_tile tiles[AV1_MAX_TILES];
+		unsigned int tiles_count;
+	} av1;
+#endif
+};
+
+/*
+ * Fields used on every picture come first, so that they share the first
+ * cache lines. The codec parameters of the picture being decoded are staged
+ * in the context, which params points to from BeginPicture on.
+ */
 struct object_surface {
 	struct object_base base;
 
-	VAStatus status;
-	int width;
-	int height;
+	/* Only accessed through surface_status and surface_set_status. */
+	VASurfaceStatus status;
+	int request_fd;
+
+	/* Context the surface is a render target of. */
+	VAContextID context_id;
 
 	unsigned int source_index;
+	unsigned int destination_index;
+	unsigned int destination_buffers_count;
+
+	/* Sequence number of the last picture, also used as its timestamp. */
+	uint64_t sequence;
+	struct timeval timestamp;
+
+	/* AV1 order hint of the frame last decoded into the surface. */
+	unsigned int order_hint;
+
+	/*
+	 * The first field of a pair was decoded and the capture buffer is
+	 * held by the decoder until the second field comes in.
+	 */
+	bool capture_held;
+	/* The request was queued along with the slices of the picture. */
+	bool request_queued;
+	bool detiled_valid;
+	unsigned int lock_count;
+
 	void *source_data;
 	unsigned int source_size;
+	unsigned int slices_size;
+	unsigned int slices_count;
+
+	union surface_params *params;
+
+	int width;
+	int height;
 
-	unsigned int destination_index;
 	void *destination_map[VIDEO_MAX_PLANES];
 	unsigned int destination_map_lengths[VIDEO_MAX_PLANES];
 	unsigned int destination_map_offsets[VIDEO_MAX_PLANES];
@@ -57,36 +134,42 @@ struct object_surface {
 	unsigned int destination_offsets[VIDEO_MAX_PLANES];
 	unsigned int destination_bytesperlines[VIDEO_MAX_PLANES];
 	unsigned int destination_planes_count;
-	unsigned int destination_buffers_count;
 
-	unsigned int slices_size;
-	unsigned int slices_count;
+	/*
+	 * Linear copy of tiled destination data, handed out by LockSurface
+	 * and backed by a DMA heap buffer (detiled_fd) for linear export.
+	 */
+	void *detiled_data;
+	unsigned int detiled_size;
+	int detiled_fd;
+} __attribute__((aligned(OBJECT_HEAP_ALIGNMENT)));
 
-	struct timeval timestamp;
+struct object_context;
+struct request_data;
 
-	union {
-		struct {
-			VAPictureParameterBufferMPEG2 picture;
-			VASliceParameterBufferMPEG2 slice;
-			VAIQMatrixBufferMPEG2 iqmatrix;
-			bool iqmatrix_set;
-		} mpeg2;
-		struct {
-			VAIQMatrixBufferH264 matrix;
-			VAPictureParameterBufferH264 picture;
-			VASliceParameterBufferH264 slice;
-		} h264;
-		struct {
-			VAPictureParameterBufferHEVC picture;
-			VASliceParameterBufferHEVC slice;
-			VAIQMatrixBufferHEVC iqmatrix;
-			bool iqmatrix_set;
-		} h265;
-	} params;
+/*
+ * Surface status is checked from any thread without taking the context
+ * lock, while it is only changed with the lock held.
+ */
+static inline VASurfaceStatus
+surface_status(struct object_surface *surface_object)
+{
+	return __atomic_load_n(&surface_object->status, __ATOMIC_ACQUIRE);
+}
 
-	int request_fd;
-};
+static inline void surface_set_status(struct object_surface *surface_object,
+				      VASurfaceStatus status)
+{
+	__atomic_store_n(&surface_object->status, status, __ATOMIC_RELEASE);
+}
 
+VAStatus surface_sync(struct request_data *driver_data,
+		      struct object_context *context_object,
+		      struct object_surface *surface_object);
+VAStatus surface_lock(struct request_data *driver_data,
+		      struct object_surface *surface_object,
+		      struct object_context **context_object);
+void surface_unlock(struct object_context *context_object);
 VAStatus RequestCreateSurfaces2(VADriverContextP context, unsigned int format,
 				unsigned int width, unsigned int height,
 				VASurfaceID *surfaces_ids,
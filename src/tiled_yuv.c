@@ -1,13 +1,98 @@
-#include "tiled_yuv.h"
-
-void tiled_to_planar(void *src, void *dst, unsigned int dst_pitch,
-                     unsigned int width, unsigned int height)
-{
-    // Naive (slow) fallback: just memcpy row by row assuming src is already planar.
-    unsigned char *in = src, *out = dst;
-    for (unsigned int y = 0; y < height; ++y) {
-        memcpy(out, in, width);
-        in += width;
-        out += dst_pitch;
-    }
-}
+#include <string.h>
+
+#include "tiled_yuv.h"
+
+#define TILE_WIDTH	32
+#define TILE_HEIGHT	32
+#define TILE_SIZE	(TILE_WIDTH * TILE_HEIGHT)
+
+/*
+ * Tiles are stored one after the other along a row of tiles, so a row of tiles
+ * spans 32 lines of the (32-aligned) pitch.
+ */
+
+static unsigned char *tiled_address(void *base, unsigned int pitch,
+				    unsigned int x, unsigned int y)
+{
+	return (unsigned char *)base + (y / TILE_HEIGHT) * pitch * TILE_HEIGHT +
+	       (x / TILE_WIDTH) * TILE_SIZE + (y % TILE_HEIGHT) * TILE_WIDTH +
+	       x % TILE_WIDTH;
+}
+
+void tiled_row_to_planar(void *src, void *dst, unsigned int src_pitch,
+			 unsigned int x, unsigned int y, unsigned int width)
+{
+	unsigned char *out = dst;
+	unsigned int count;
+
+	while (width > 0) {
+		count = TILE_WIDTH - x % TILE_WIDTH;
+		if (count > width)
+			count = width;
+
+		memcpy(out, tiled_address(src, src_pitch, x, y), count);
+
+		out += count;
+		x += count;
+		width -= count;
+	}
+}
+
+void planar_row_to_tiled(void *src, void *dst, unsigned int dst_pitch,
+			 unsigned int x, unsigned int y, unsigned int width)
+{
+	unsigned char *in = src;
+	unsigned int count;
+
+	while (width > 0) {
+		count = TILE_WIDTH - x % TILE_WIDTH;
+		if (count > width)
+			count = width;
+
+		memcpy(tiled_address(dst, dst_pitch, x, y), in, count);
+
+		in += count;
+		x += count;
+		width -= count;
+	}
+}
+
+#ifndef __arm__
+
+/* The ARMv7 NEON versions of these live in tiled_yuv.S. */
+
+void tiled_to_planar(void *src, void *dst, unsigned int dst_pitch,
+		     unsigned int width, unsigned int height)
+{
+	unsigned int src_pitch = (width + TILE_WIDTH - 1) & ~(TILE_WIDTH - 1);
+	unsigned char *out = dst;
+	unsigned int y;
+
+	for (y = 0; y < height; y++) {
+		tiled_row_to_planar(src, out, src_pitch, 0, y, width);
+		out += dst_pitch;
+	}
+}
+
+void tiled_deinterleave_to_planar(void *src, void *dst1, void *dst2,
+				  unsigned int dst_pitch, unsigned int width,
+				  unsigned int height)
+{
+	unsigned int src_pitch = (width + TILE_WIDTH - 1) & ~(TILE_WIDTH - 1);
+	unsigned char *out1 = dst1, *out2 = dst2;
+	unsigned char *in;
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width / 2; x++) {
+			in = tiled_address(src, src_pitch, x * 2, y);
+			out1[x] = in[0];
+			out2[x] = in[1];
+		}
+
+		out1 += dst_pitch;
+		out2 += dst_pitch;
+	}
+}
+
+#endif
@@ -27,4 +27,10 @@ void tiled_deinterleave_to_planar(void *src, void *dst1, void *dst2,
 				  unsigned int dst_pitch, unsigned int width,
 				  unsigned int height);
 
+void tiled_row_to_planar(void *src, void *dst, unsigned int src_pitch,
+			 unsigned int x, unsigned int y, unsigned int width);
+
+void planar_row_to_tiled(void *src, void *dst, unsigned int dst_pitch,
+			 unsigned int x, unsigned int y, unsigned int width);
+
 #endif
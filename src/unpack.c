@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2026 libva-v4l2-request contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdint.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "unpack.h"
+
+/*
+ * Packed 10-bit samples (as in NV15) come in groups of four within five
+ * bytes, least significant bits first. They are expanded to the 16-bit
+ * MSB-aligned samples of P010.
+ *
+ * Each sample is contained within a 16-bit little-endian word starting at
+ * the byte it begins in, so the vector versions gather the four overlapping
+ * words of each group and shift each of them into place.
+ */
+
+void unpack_10bit_row(void *src, void *dst, unsigned int count)
+{
+	const uint8_t *in = src;
+	uint16_t *out = dst;
+	unsigned int i = 0;
+	unsigned int bit;
+	uint16_t word;
+
+#if defined(__ARM_NEON)
+	static const int16_t shifts_values[8] = { 6, 4, 2, 0, 6, 4, 2, 0 };
+	int16x8_t shifts = vld1q_s16(shifts_values);
+	uint16x8_t mask = vdupq_n_u16(0xffc0);
+
+	/* Loads span 14 bytes, which 12 samples always cover. */
+	for (; i + 12 <= count; i += 8) {
+		const uint8_t *p = in + i / 4 * 5;
+		uint16x4_t low, high;
+
+		low = vzip_u16(vreinterpret_u16_u8(vld1_u8(p)),
+			       vreinterpret_u16_u8(vld1_u8(p + 1))).val[0];
+		high = vzip_u16(vreinterpret_u16_u8(vld1_u8(p + 5)),
+				vreinterpret_u16_u8(vld1_u8(p + 6))).val[0];
+
+		vst1q_u16(out + i,
+			  vandq_u16(vshlq_u16(vcombine_u16(low, high), shifts),
+				    mask));
+	}
+#elif defined(__SSE2__)
+	/* Multiplying by a power of two is a per-lane left shift. */
+	__m128i multipliers = _mm_set_epi16(1, 4, 16, 64, 1, 4, 16, 64);
+	__m128i mask = _mm_set1_epi16((short)0xffc0);
+
+	/* Loads span 14 bytes, which 12 samples always cover. */
+	for (; i + 12 <= count; i += 8) {
+		const uint8_t *p = in + i / 4 * 5;
+		__m128i low, high;
+
+		low = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)p),
+					 _mm_loadl_epi64((const __m128i *)(p + 1)));
+		high = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(p + 5)),
+					  _mm_loadl_epi64((const __m128i *)(p + 6)));
+
+		_mm_storeu_si128((__m128i *)(out + i),
+				 _mm_and_si128(_mm_mullo_epi16(_mm_unpacklo_epi64(low, high),
+							       multipliers),
+					       mask));
+	}
+#endif
+
+	for (; i < count; i++) {
+		bit = i * 10;
+		word = in[bit / 8] | in[bit / 8 + 1] << 8;
+		out[i] = ((word >> (bit % 8)) & 0x3ff) << 6;
+	}
+}
@@ -92,6 +92,21 @@ int v4l2_query_capabilities(int video_fd, unsigned int *capabilities)
 	return 0;
 }
 
+bool v4l2_driver_is(int video_fd, const char *driver)
+{
+	struct v4l2_capability capability;
+	int rc;
+
+	memset(&capability, 0, sizeof(capability));
+
+	rc = ioctl(video_fd, VIDIOC_QUERYCAP, &capability);
+	if (rc < 0)
+		return false;
+
+	return strncmp((char *)capability.driver, driver,
+		       sizeof(capability.driver)) == 0;
+}
+
 static void v4l2_setup_format(struct v4l2_format *format, unsigned int type,
 			      unsigned int width, unsigned int height,
 			      unsigned int pixelformat)
@@ -101,7 +116,7 @@ static void v4l2_setup_format(struct v4l2_format *format, unsigned int type,
 	memset(format, 0, sizeof(*format));
 	format->type = type;
 
-	sizeimage = v4l2_type_is_output(type) ? SOURCE_SIZE_MAX : 0;
+	sizeimage = v4l2_type_is_output(type) ? SOURCE_SIZE_DEFAULT : 0;
 
 	if (v4l2_type_is_mplane(type)) {
 		format->fmt.pix_mp.width = width;
@@ -172,6 +187,14 @@ int v4l2_set_format(int video_fd, unsigned int type, unsigned int pixelformat,
 		return -1;
 	}
 
+	/* Drivers silently fall back to another format they support. */
+	if ((v4l2_type_is_mplane(type) ? format.fmt.pix_mp.pixelformat :
+	     format.fmt.pix.pixelformat) != pixelformat) {
+		request_log("Format %.4s not accepted for type %d\n",
+			    (char *)&pixelformat, type);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -239,7 +262,8 @@ int v4l2_get_format(int video_fd, unsigned int type, unsigned int *width,
 }
 
 int v4l2_create_buffers(int video_fd, unsigned int type,
-			unsigned int buffers_count, unsigned int *index_base)
+			unsigned int buffers_count, unsigned int size,
+			unsigned int *index_base, unsigned int *capabilities)
 {
 	struct v4l2_create_buffers buffers;
 	int rc;
@@ -256,6 +280,14 @@ int v4l2_create_buffers(int video_fd, unsigned int type,
 		return -1;
 	}
 
+	/* Single-plane buffers can be made larger than the format asks for. */
+	if (size > 0) {
+		if (v4l2_type_is_mplane(type))
+			buffers.format.fmt.pix_mp.plane_fmt[0].sizeimage = size;
+		else
+			buffers.format.fmt.pix.sizeimage = size;
+	}
+
 	rc = ioctl(video_fd, VIDIOC_CREATE_BUFS, &buffers);
 	if (rc < 0) {
 		request_log("Unable to create buffer for type %d: %s\n", type,
@@ -266,6 +298,9 @@ int v4l2_create_buffers(int video_fd, unsigned int type,
 	if (index_base != NULL)
 		*index_base = buffers.index;
 
+	if (capabilities != NULL)
+		*capabilities = buffers.capabilities;
+
 	return 0;
 }
 
@@ -334,7 +369,8 @@ int v4l2_request_buffers(int video_fd, unsigned int type,
 
 int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
 		      struct timeval *timestamp, unsigned int index,
-		      unsigned int size, unsigned int buffers_count)
+		      unsigned int size, unsigned int flags,
+		      unsigned int buffers_count)
 {
 	struct v4l2_plane planes[buffers_count];
 	struct v4l2_buffer buffer;
@@ -349,6 +385,7 @@ int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
 	buffer.index = index;
 	buffer.length = buffers_count;
 	buffer.m.planes = planes;
+	buffer.flags = flags;
 
 	for (i = 0; i < buffers_count; i++)
 		if (v4l2_type_is_mplane(type))
@@ -357,7 +394,7 @@ int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
 			buffer.bytesused = size;
 
 	if (request_fd >= 0) {
-		buffer.flags = V4L2_BUF_FLAG_REQUEST_FD;
+		buffer.flags |= V4L2_BUF_FLAG_REQUEST_FD;
 		buffer.request_fd = request_fd;
 	}
 
@@ -374,7 +411,8 @@ int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
 }
 
 int v4l2_dequeue_buffer(int video_fd, int request_fd, unsigned int type,
-			unsigned int index, unsigned int buffers_count)
+			unsigned int index, unsigned int buffers_count,
+			struct timeval *timestamp)
 {
 	struct v4l2_plane planes[buffers_count];
 	struct v4l2_buffer buffer;
@@ -400,6 +438,9 @@ int v4l2_dequeue_buffer(int video_fd, int request_fd, unsigned int type,
 		return -1;
 	}
 
+	if (timestamp != NULL)
+		*timestamp = buffer.timestamp;
+
 	return 0;
 }
 
@@ -462,6 +503,67 @@ int v4l2_set_control(int video_fd, int request_fd, unsigned int id, void *data,
 	return 0;
 }
 
+int v4l2_get_control(int video_fd, unsigned int id, int *value)
+{
+	struct v4l2_ext_control control;
+	struct v4l2_ext_controls controls;
+	int rc;
+
+	memset(&control, 0, sizeof(control));
+	memset(&controls, 0, sizeof(controls));
+
+	control.id = id;
+
+	controls.controls = &control;
+	controls.count = 1;
+
+	rc = ioctl(video_fd, VIDIOC_G_EXT_CTRLS, &controls);
+	if (rc < 0)
+		return -1;
+
+	*value = control.value;
+
+	return 0;
+}
+
+int v4l2_set_control_value(int video_fd, unsigned int id, int value)
+{
+	struct v4l2_ext_control control;
+	struct v4l2_ext_controls controls;
+	int rc;
+
+	memset(&control, 0, sizeof(control));
+	memset(&controls, 0, sizeof(controls));
+
+	control.id = id;
+	control.value = value;
+
+	controls.controls = &control;
+	controls.count = 1;
+
+	rc = ioctl(video_fd, VIDIOC_S_EXT_CTRLS, &controls);
+	if (rc < 0) {
+		request_log("Unable to set control: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+bool v4l2_query_menu(int video_fd, unsigned int id, unsigned int index)
+{
+	struct v4l2_querymenu querymenu;
+	int rc;
+
+	memset(&querymenu, 0, sizeof(querymenu));
+	querymenu.id = id;
+	querymenu.index = index;
+
+	rc = ioctl(video_fd, VIDIOC_QUERYMENU, &querymenu);
+
+	return rc >= 0;
+}
+
 int v4l2_set_stream(int video_fd, unsigned int type, bool enable)
 {
 	enum v4l2_buf_type buf_type = type;
@@ -27,11 +27,14 @@
 
 #include <stdbool.h>
 
-#define SOURCE_SIZE_MAX						(1024 * 1024)
+#define SOURCE_SIZE_DEFAULT					(1024 * 1024)
+#define SOURCE_SIZE_LIMIT					(64 * 1024 * 1024)
+#define SLICE_SIZE_DEFAULT					(64 * 1024)
 
 unsigned int v4l2_type_video_output(bool mplane);
 unsigned int v4l2_type_video_capture(bool mplane);
 int v4l2_query_capabilities(int video_fd, unsigned int *capabilities);
+bool v4l2_driver_is(int video_fd, const char *driver);
 bool v4l2_find_format(int video_fd, unsigned int type,
 		      unsigned int pixelformat);
 int v4l2_set_format(int video_fd, unsigned int type, unsigned int pixelformat,
@@ -40,7 +43,8 @@ int v4l2_get_format(int video_fd, unsigned int type, unsigned int *width,
 		    unsigned int *height, unsigned int *bytesperline,
 		    unsigned int *sizes, unsigned int *planes_count);
 int v4l2_create_buffers(int video_fd, unsigned int type,
-			unsigned int buffers_count, unsigned int *index_base);
+			unsigned int buffers_count, unsigned int size,
+			unsigned int *index_base, unsigned int *capabilities);
 int v4l2_query_buffer(int video_fd, unsigned int type, unsigned int index,
 		      unsigned int *lengths, unsigned int *offsets,
 		      unsigned int buffers_count);
@@ -48,14 +52,19 @@ int v4l2_request_buffers(int video_fd, unsigned int type,
 			 unsigned int buffers_count);
 int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
 		      struct timeval *timestamp, unsigned int index,
-		      unsigned int size, unsigned int buffers_count);
+		      unsigned int size, unsigned int flags,
+		      unsigned int buffers_count);
 int v4l2_dequeue_buffer(int video_fd, int request_fd, unsigned int type,
-			unsigned int index, unsigned int buffers_count);
+			unsigned int index, unsigned int buffers_count,
+			struct timeval *timestamp);
 int v4l2_export_buffer(int video_fd, unsigned int type, unsigned int index,
 		       unsigned int flags, int *export_fds,
 		       unsigned int export_fds_count);
 int v4l2_set_control(int video_fd, int request_fd, unsigned int id, void *data,
 		     unsigned int size);
+int v4l2_get_control(int video_fd, unsigned int id, int *value);
+int v4l2_set_control_value(int video_fd, unsigned int id, int value);
+bool v4l2_query_menu(int video_fd, unsigned int id, unsigned int index);
 int v4l2_set_stream(int video_fd, unsigned int type, bool enable);
 
 #endif
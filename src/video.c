@@ -34,6 +34,12 @@
 #include "utils.h"
 #include "video.h"
 
+/* Rockchip vendor kernels expose AFBC-compressed YUV 4:2:0 as FBC0. */
+#ifndef V4L2_PIX_FMT_FBC0
+#define V4L2_PIX_FMT_FBC0	v4l2_fourcc('F', 'B', 'C', '0')
+#endif
+
+/* Formats are listed in order of preference when the consumer has none. */
 static struct video_format formats[] = {
 	{
 		.description		= "NV12 YUV",
@@ -42,7 +48,42 @@ static struct video_format formats[] = {
 		.v4l2_mplane		= false,
 		.drm_format		= DRM_FORMAT_NV12,
 		.drm_modifier		= DRM_FORMAT_MOD_NONE,
+		.bit_depth		= 8,
+		.planes_count		= 2,
+		.planes			= {
+			{ 0, 1, DRM_FORMAT_R8 },
+			{ 0, 2, DRM_FORMAT_GR88 },
+		},
+		.bpp			= 16,
+	},
+	{
+		.description		= "NV12 YUV (multi-planar API)",
+		.v4l2_format		= V4L2_PIX_FMT_NV12,
+		.v4l2_buffers_count	= 1,
+		.v4l2_mplane		= true,
+		.drm_format		= DRM_FORMAT_NV12,
+		.drm_modifier		= DRM_FORMAT_MOD_NONE,
+		.bit_depth		= 8,
+		.planes_count		= 2,
+		.planes			= {
+			{ 0, 1, DRM_FORMAT_R8 },
+			{ 0, 2, DRM_FORMAT_GR88 },
+		},
+		.bpp			= 16,
+	},
+	{
+		.description		= "NV12M YUV (separate buffers)",
+		.v4l2_format		= V4L2_PIX_FMT_NV12M,
+		.v4l2_buffers_count	= 2,
+		.v4l2_mplane		= true,
+		.drm_format		= DRM_FORMAT_NV12,
+		.drm_modifier		= DRM_FORMAT_MOD_NONE,
+		.bit_depth		= 8,
 		.planes_count		= 2,
+		.planes			= {
+			{ 0, 1, DRM_FORMAT_R8 },
+			{ 1, 2, DRM_FORMAT_GR88 },
+		},
 		.bpp			= 16,
 	},
 	{
@@ -52,22 +93,91 @@ static struct video_format formats[] = {
 		.v4l2_mplane		= false,
 		.drm_format		= DRM_FORMAT_NV12,
 		.drm_modifier		= DRM_FORMAT_MOD_ALLWINNER_TILED,
+		.bit_depth		= 8,
 		.planes_count		= 2,
+		.planes			= {
+			{ 0, 1, DRM_FORMAT_R8 },
+			{ 0, 2, DRM_FORMAT_GR88 },
+		},
 		.bpp			= 16
 	},
+	{
+		.description		= "P010 YUV",
+		.v4l2_format		= V4L2_PIX_FMT_P010,
+		.v4l2_buffers_count	= 1,
+		.v4l2_mplane		= false,
+		.drm_format		= DRM_FORMAT_P010,
+		.drm_modifier		= DRM_FORMAT_MOD_NONE,
+		.bit_depth		= 10,
+		.planes_count		= 2,
+		.planes			= {
+			{ 0, 1, DRM_FORMAT_R16 },
+			{ 0, 2, DRM_FORMAT_GR1616 },
+		},
+		.bpp			= 24,
+	},
+	{
+		.description		= "P010 YUV (multi-planar API)",
+		.v4l2_format		= V4L2_PIX_FMT_P010,
+		.v4l2_buffers_count	= 1,
+		.v4l2_mplane		= true,
+		.drm_format		= DRM_FORMAT_P010,
+		.drm_modifier		= DRM_FORMAT_MOD_NONE,
+		.bit_depth		= 10,
+		.planes_count		= 2,
+		.planes			= {
+			{ 0, 1, DRM_FORMAT_R16 },
+			{ 0, 2, DRM_FORMAT_GR1616 },
+		},
+		.bpp			= 24,
+	},
+	/* Packed 10-bit samples have no single-plane DRM equivalent. */
+	{
+		.description		= "NV15 packed 10-bit YUV",
+		.v4l2_format		= V4L2_PIX_FMT_NV15,
+		.v4l2_buffers_count	= 1,
+		.v4l2_mplane		= true,
+		.drm_format		= DRM_FORMAT_NV15,
+		.drm_modifier		= DRM_FORMAT_MOD_NONE,
+		.bit_depth		= 10,
+		.planes_count		= 2,
+		.planes			= {
+			{ 0, 1, 0 },
+			{ 0, 2, 0 },
+		},
+		.bpp			= 15,
+	},
+	/*
+	 * Compressed formats are a single opaque plane that only the display
+	 * and GPU can make sense of, so they are never picked for CPU access.
+	 */
+	{
+		.description		= "Rockchip AFBC YUV 4:2:0",
+		.v4l2_format		= V4L2_PIX_FMT_FBC0,
+		.v4l2_buffers_count	= 1,
+		.v4l2_mplane		= true,
+		.drm_format		= DRM_FORMAT_YUV420_8BIT,
+		.drm_modifier		= DRM_FORMAT_MOD_ARM_AFBC(
+			AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 |
+			AFBC_FORMAT_MOD_SPARSE),
+		.compressed		= true,
+		.bit_depth		= 8,
+		.planes_count		= 1,
+		.planes			= {
+			{ 0, 1, 0 },
+		},
+		.bpp			= 12,
+	},
 };
 
 static unsigned int formats_count = sizeof(formats) / sizeof(formats[0]);
 
-struct video_format *video_format_find(unsigned int pixelformat)
+struct video_format *video_format_get(unsigned int index)
 {
-	unsigned int i;
-
-	for (i = 0; i < formats_count; i++)
-		if (formats[i].v4l2_format == pixelformat)
-			return &formats[i];
+	if (index >= formats_count)
+		return NULL;
 
-	return NULL;
+	return &formats[index];
 }
 
 bool video_format_is_linear(struct video_format *format)
@@ -77,3 +187,11 @@ bool video_format_is_linear(struct video_format *format)
 
 	return format->drm_modifier == DRM_FORMAT_MOD_NONE;
 }
+
+bool video_format_is_compressed(struct video_format *format)
+{
+	if (format == NULL)
+		return false;
+
+	return format->compressed;
+}
@@ -27,6 +27,20 @@
 
 #include <stdbool.h>
 
+#include <linux/videodev2.h>
+
+/* Rockchip packed 10-bit 4:2:0, not yet in every set of kernel headers. */
+#ifndef V4L2_PIX_FMT_NV15
+#define V4L2_PIX_FMT_NV15	v4l2_fourcc('N', 'V', '1', '5')
+#endif
+
+/* A logical plane, stored in one of the V4L2 buffers (memory planes). */
+struct video_format_plane {
+	unsigned int buffer;
+	unsigned int vertical_subsampling;
+	unsigned int drm_format;
+};
+
 struct video_format {
 	char *description;
 	unsigned int v4l2_format;
@@ -34,11 +48,15 @@ struct video_format {
 	bool v4l2_mplane;
 	unsigned int drm_format;
 	uint64_t drm_modifier;
+	bool compressed;
+	unsigned int bit_depth;
 	unsigned int planes_count;
+	struct video_format_plane planes[VIDEO_MAX_PLANES];
 	unsigned int bpp;
 };
 
-struct video_format *video_format_find(unsigned int pixelformat);
+struct video_format *video_format_get(unsigned int index);
 bool video_format_is_linear(struct video_format *format);
+bool video_format_is_compressed(struct video_format *format);
 
 #endif
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2026 libva-v4l2-request contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "vp8.h"
+#include "context.h"
+#include "request.h"
+#include "surface.h"
+
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#include "utils.h"
+#include "v4l2.h"
+
+/*
+ * VA hands us the frame starting at the first partition, while V4L2 expects
+ * the whole frame including the uncompressed data chunk (frame tag, plus
+ * start code and dimensions for key frames), so rebuild it in front.
+ */
+static int vp8_write_frame_header(struct request_data *driver_data,
+				  struct object_context *context_object,
+				  struct object_surface *surface_object,
+				  bool key_frame)
+{
+	VAPictureParameterBufferVP8 *picture =
+		&surface_object->params->vp8.picture;
+	VASliceParameterBufferVP8 *slice = &surface_object->params->vp8.slice;
+	unsigned int header_size = key_frame ? 10 : 3;
+	unsigned int first_part_size;
+	unsigned char *data;
+	uint32_t tag;
+	int rc;
+
+	rc = context_reserve_source(driver_data, context_object, surface_object,
+				    surface_object->slices_size + header_size);
+	if (rc < 0) {
+		request_log("VP8 frame does not fit the source buffer\n");
+		return -1;
+	}
+
+	data = surface_object->source_data;
+
+	memmove(data + header_size, data, surface_object->slices_size);
+
+	first_part_size = slice->partition_size[0] +
+			  (slice->macroblock_offset + 7) / 8;
+
+	/* The VA key_frame flag has the bitstream meaning: 0 for key frames. */
+	tag = picture->pic_fields.bits.key_frame |
+	      picture->pic_fields.bits.version << 1 |
+	      1 << 4 |
+	      first_part_size << 5;
+
+	data[0] = tag & 0xff;
+	data[1] = (tag >> 8) & 0xff;
+	data[2] = (tag >> 16) & 0xff;
+
+	if (key_frame) {
+		data[3] = 0x9d;
+		data[4] = 0x01;
+		data[5] = 0x2a;
+		data[6] = picture->frame_width & 0xff;
+		data[7] = (picture->frame_width >> 8) & 0x3f;
+		data[8] = picture->frame_height & 0xff;
+		data[9] = (picture->frame_height >> 8) & 0x3f;
+	}
+
+	surface_object->slices_size += header_size;
+
+	return 0;
+}
+
+static uint64_t vp8_reference_timestamp(struct request_data *driver_data,
+					VASurfaceID surface_id)
+{
+	struct object_surface *surface_object;
+
+	surface_object = SURFACE(driver_data, surface_id);
+	if (surface_object == NULL)
+		return 0;
+
+	return v4l2_timeval_to_ns(&surface_object->timestamp);
+}
+
+int vp8_set_controls(struct request_data *driver_data,
+		     struct object_context *context_object,
+		     struct object_surface *surface_object)
+{
+	VAPictureParameterBufferVP8 *picture =
+		&surface_object->params->vp8.picture;
+	VASliceParameterBufferVP8 *slice = &surface_object->params->vp8.slice;
+	VAProbabilityDataBufferVP8 *probabilities =
+		&surface_object->params->vp8.probabilities;
+	VAIQMatrixBufferVP8 *iqmatrix = &surface_object->params->vp8.iqmatrix;
+	struct v4l2_ctrl_vp8_frame frame;
+	uint16_t *quantization_index;
+	bool key_frame;
+	unsigned int i;
+	int rc;
+
+	if (slice->num_of_partitions < 2 || slice->num_of_partitions > 9) {
+		request_log("Invalid VP8 partitions count: %d\n",
+			    slice->num_of_partitions);
+		return -1;
+	}
+
+	key_frame = picture->pic_fields.bits.key_frame == 0;
+
+	rc = vp8_write_frame_header(driver_data, context_object, surface_object,
+				    key_frame);
+	if (rc < 0)
+		return -1;
+
+	memset(&frame, 0, sizeof(frame));
+
+	/*
+	 * VA provides absolute per-segment quantizer indices and filter levels
+	 * rather than the coded values, so segment updates are passed in
+	 * absolute mode and the frame-level deltas taken from segment 0.
+	 */
+	for (i = 0; i < 4; i++) {
+		frame.segment.quant_update[i] =
+			iqmatrix->quantization_index[i][0];
+		frame.segment.lf_update[i] = picture->loop_filter_level[i];
+	}
+
+	for (i = 0; i < 3; i++)
+		frame.segment.segment_probs[i] =
+			picture->mb_segment_tree_probs[i];
+
+	if (picture->pic_fields.bits.segmentation_enabled)
+		frame.segment.flags |= V4L2_VP8_SEGMENT_FLAG_ENABLED;
+	if (picture->pic_fields.bits.update_mb_segmentation_map)
+		frame.segment.flags |= V4L2_VP8_SEGMENT_FLAG_UPDATE_MAP;
+	if (picture->pic_fields.bits.update_segment_feature_data)
+		frame.segment.flags |= V4L2_VP8_SEGMENT_FLAG_UPDATE_FEATURE_DATA;
+
+	for (i = 0; i < 4; i++) {
+		frame.lf.ref_frm_delta[i] =
+			picture->loop_filter_deltas_ref_frame[i];
+		frame.lf.mb_mode_delta[i] = picture->loop_filter_deltas_mode[i];
+	}
+
+	frame.lf.sharpness_level = picture->pic_fields.bits.sharpness_level;
+	frame.lf.level = picture->loop_filter_level[0];
+
+	if (picture->pic_fields.bits.loop_filter_adj_enable)
+		frame.lf.flags |= V4L2_VP8_LF_ADJ_ENABLE;
+	if (picture->pic_fields.bits.mode_ref_lf_delta_update)
+		frame.lf.flags |= V4L2_VP8_LF_DELTA_UPDATE;
+	if (picture->pic_fields.bits.filter_type)
+		frame.lf.flags |= V4L2_VP8_LF_FILTER_TYPE_SIMPLE;
+
+	quantization_index = iqmatrix->quantization_index[0];
+
+	frame.quant.y_ac_qi = quantization_index[0];
+	frame.quant.y_dc_delta = quantization_index[1] - quantization_index[0];
+	frame.quant.y2_dc_delta = quantization_index[2] - quantization_index[0];
+	frame.quant.y2_ac_delta = quantization_index[3] - quantization_index[0];
+	frame.quant.uv_dc_delta = quantization_index[4] - quantization_index[0];
+	frame.quant.uv_ac_delta = quantization_index[5] - quantization_index[0];
+
+	memcpy(frame.entropy.coeff_probs, probabilities->dct_coeff_probs,
+	       sizeof(frame.entropy.coeff_probs));
+	memcpy(frame.entropy.y_mode_probs, picture->y_mode_probs,
+	       sizeof(frame.entropy.y_mode_probs));
+	memcpy(frame.entropy.uv_mode_probs, picture->uv_mode_probs,
+	       sizeof(frame.entropy.uv_mode_probs));
+	memcpy(frame.entropy.mv_probs, picture->mv_probs,
+	       sizeof(frame.entropy.mv_probs));
+
+	frame.coder_state.range = picture->bool_coder_ctx.range;
+	frame.coder_state.value = picture->bool_coder_ctx.value;
+	frame.coder_state.bit_count = picture->bool_coder_ctx.count;
+
+	frame.width = picture->frame_width;
+	frame.height = picture->frame_height;
+
+	frame.version = picture->pic_fields.bits.version;
+	frame.prob_skip_false = picture->prob_skip_false;
+	frame.prob_intra = picture->prob_intra;
+	frame.prob_last = picture->prob_last;
+	frame.prob_gf = picture->prob_gf;
+
+	frame.num_dct_parts = slice->num_of_partitions - 1;
+	for (i = 0; i < frame.num_dct_parts; i++)
+		frame.dct_part_sizes[i] = slice->partition_size[i + 1];
+
+	frame.first_part_size = slice->partition_size[0] +
+				(slice->macroblock_offset + 7) / 8;
+	frame.first_part_header_bits = slice->macroblock_offset;
+
+	frame.last_frame_ts =
+		vp8_reference_timestamp(driver_data, picture->last_ref_frame);
+	frame.golden_frame_ts =
+		vp8_reference_timestamp(driver_data, picture->golden_ref_frame);
+	frame.alt_frame_ts =
+		vp8_reference_timestamp(driver_data, picture->alt_ref_frame);
+
+	/* VA has no show_frame flag and decoding does not depend on it. */
+	frame.flags |= V4L2_VP8_FRAME_FLAG_SHOW_FRAME;
+
+	if (key_frame)
+		frame.flags |= V4L2_VP8_FRAME_FLAG_KEY_FRAME;
+	if (picture->pic_fields.bits.mb_no_coeff_skip)
+		frame.flags |= V4L2_VP8_FRAME_FLAG_MB_NO_SKIP_COEFF;
+	if (picture->pic_fields.bits.sign_bias_golden)
+		frame.flags |= V4L2_VP8_FRAME_FLAG_SIGN_BIAS_GOLDEN;
+	if (picture->pic_fields.bits.sign_bias_alternate)
+		frame.flags |= V4L2_VP8_FRAME_FLAG_SIGN_BIAS_ALT;
+
+	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
+			      V4L2_CID_STATELESS_VP8_FRAME, &frame,
+			      sizeof(frame));
+	if (rc < 0)
+		return -1;
+
+	return 0;
+}
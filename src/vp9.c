@@ -0,0 +1,773 @@
+/*
+ * Copyright (C) 2026 libva-v4l2-request contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "vp9.h"
+#include "context.h"
+#include "request.h"
+#include "surface.h"
+
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#include "utils.h"
+#include "v4l2.h"
+
+#define VP9_FRAME_SYNC_CODE		0x498342
+#define VP9_COLOR_SPACE_RGB		7
+
+struct vp9_bit_reader {
+	unsigned char *data;
+	unsigned int size;
+	unsigned int offset;
+};
+
+struct vp9_bool_decoder {
+	struct vp9_bit_reader reader;
+	unsigned int value;
+	unsigned int range;
+};
+
+/*
+ * VA only provides derived values (per-segment quantizer scales and filter
+ * levels) where V4L2 wants the syntax elements, so both frame headers are
+ * parsed again from the bitstream, which VA passes in full.
+ */
+
+static unsigned int vp9_read_bit(struct vp9_bit_reader *reader)
+{
+	unsigned int bit = 0;
+
+	/* Reading past the end yields zeros, callers check for overrun. */
+	if (reader->offset < reader->size * 8)
+		bit = (reader->data[reader->offset / 8] >>
+		       (7 - reader->offset % 8)) & 1;
+
+	reader->offset++;
+
+	return bit;
+}
+
+static unsigned int vp9_read_bits(struct vp9_bit_reader *reader,
+				  unsigned int count)
+{
+	unsigned int value = 0;
+
+	while (count-- > 0)
+		value = value << 1 | vp9_read_bit(reader);
+
+	return value;
+}
+
+static int vp9_read_signed(struct vp9_bit_reader *reader, unsigned int count)
+{
+	int value = vp9_read_bits(reader, count);
+
+	return vp9_read_bit(reader) ? -value : value;
+}
+
+static bool vp9_read_overrun(struct vp9_bit_reader *reader)
+{
+	return reader->offset > reader->size * 8;
+}
+
+static unsigned int vp9_read_bool(struct vp9_bool_decoder *decoder,
+				  unsigned int probability)
+{
+	unsigned int split = 1 + (((decoder->range - 1) * probability) >> 8);
+	unsigned int bit;
+
+	if (decoder->value < split) {
+		decoder->range = split;
+		bit = 0;
+	} else {
+		decoder->range -= split;
+		decoder->value -= split;
+		bit = 1;
+	}
+
+	while (decoder->range < 128) {
+		decoder->value = decoder->value << 1 |
+				 vp9_read_bit(&decoder->reader);
+		decoder->range <<= 1;
+	}
+
+	return bit;
+}
+
+static unsigned int vp9_read_literal(struct vp9_bool_decoder *decoder,
+				     unsigned int count)
+{
+	unsigned int value = 0;
+
+	while (count-- > 0)
+		value = value << 1 | vp9_read_bool(decoder, 128);
+
+	return value;
+}
+
+static int vp9_bool_init(struct vp9_bool_decoder *decoder,
+			 unsigned char *data, unsigned int size)
+{
+	decoder->reader.data = data;
+	decoder->reader.size = size;
+	decoder->reader.offset = 0;
+
+	decoder->value = vp9_read_bits(&decoder->reader, 8);
+	decoder->range = 255;
+
+	/* The first bool is a marker that must be zero. */
+	if (vp9_read_bool(decoder, 128) != 0)
+		return -1;
+
+	return 0;
+}
+
+static void vp9_setup_past_independence(struct vp9_header_state *state)
+{
+	memset(state, 0, sizeof(*state));
+
+	state->lf_ref_deltas[0] = 1;
+	state->lf_ref_deltas[1] = 0;
+	state->lf_ref_deltas[2] = -1;
+	state->lf_ref_deltas[3] = -1;
+}
+
+static int vp9_parse_color_config(struct vp9_bit_reader *reader,
+				  struct v4l2_ctrl_vp9_frame *frame)
+{
+	unsigned int color_space;
+
+	/* The bit depth itself is taken from the VA picture parameters. */
+	if (frame->profile >= 2)
+		vp9_read_bit(reader);
+
+	color_space = vp9_read_bits(reader, 3);
+	if (color_space != VP9_COLOR_SPACE_RGB) {
+		if (vp9_read_bit(reader))
+			frame->flags |= V4L2_VP9_FRAME_FLAG_COLOR_RANGE_FULL_SWING;
+
+		if (frame->profile == 1 || frame->profile == 3) {
+			request_log("Unsupported VP9 chroma subsampling\n");
+			return -1;
+		}
+	} else {
+		request_log("Unsupported VP9 RGB color space\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void vp9_parse_frame_size(struct vp9_bit_reader *reader,
+				 struct v4l2_ctrl_vp9_frame *frame)
+{
+	frame->frame_width_minus_1 = vp9_read_bits(reader, 16);
+	frame->frame_height_minus_1 = vp9_read_bits(reader, 16);
+}
+
+static void vp9_parse_render_size(struct vp9_bit_reader *reader,
+				  struct v4l2_ctrl_vp9_frame *frame)
+{
+	if (vp9_read_bit(reader)) {
+		frame->render_width_minus_1 = vp9_read_bits(reader, 16);
+		frame->render_height_minus_1 = vp9_read_bits(reader, 16);
+	} else {
+		frame->render_width_minus_1 = frame->frame_width_minus_1;
+		frame->render_height_minus_1 = frame->frame_height_minus_1;
+	}
+}
+
+static void vp9_parse_loop_filter(struct vp9_bit_reader *reader,
+				  struct vp9_header_state *state,
+				  struct v4l2_ctrl_vp9_frame *frame)
+{
+	unsigned int i;
+
+	frame->lf.level = vp9_read_bits(reader, 6);
+	frame->lf.sharpness = vp9_read_bits(reader, 3);
+
+	if (vp9_read_bit(reader)) {
+		frame->lf.flags |= V4L2_VP9_LOOP_FILTER_FLAG_DELTA_ENABLED;
+
+		if (vp9_read_bit(reader)) {
+			frame->lf.flags |=
+				V4L2_VP9_LOOP_FILTER_FLAG_DELTA_UPDATE;
+
+			for (i = 0; i < 4; i++)
+				if (vp9_read_bit(reader))
+					state->lf_ref_deltas[i] =
+						vp9_read_signed(reader, 6);
+
+			for (i = 0; i < 2; i++)
+				if (vp9_read_bit(reader))
+					state->lf_mode_deltas[i] =
+						vp9_read_signed(reader, 6);
+		}
+	}
+
+	memcpy(frame->lf.ref_deltas, state->lf_ref_deltas,
+	       sizeof(frame->lf.ref_deltas));
+	memcpy(frame->lf.mode_deltas, state->lf_mode_deltas,
+	       sizeof(frame->lf.mode_deltas));
+}
+
+static int vp9_read_delta_q(struct vp9_bit_reader *reader)
+{
+	if (!vp9_read_bit(reader))
+		return 0;
+
+	return vp9_read_signed(reader, 4);
+}
+
+static void vp9_parse_quantization(struct vp9_bit_reader *reader,
+				   struct v4l2_ctrl_vp9_frame *frame)
+{
+	frame->quant.base_q_idx = vp9_read_bits(reader, 8);
+	frame->quant.delta_q_y_dc = vp9_read_delta_q(reader);
+	frame->quant.delta_q_uv_dc = vp9_read_delta_q(reader);
+	frame->quant.delta_q_uv_ac = vp9_read_delta_q(reader);
+}
+
+static void vp9_parse_segmentation(struct vp9_bit_reader *reader,
+				   struct vp9_header_state *state,
+				   struct v4l2_ctrl_vp9_frame *frame)
+{
+	static const unsigned int feature_bits[V4L2_VP9_SEG_LVL_MAX] = {
+		8, 6, 2, 0
+	};
+	static const bool feature_signed[V4L2_VP9_SEG_LVL_MAX] = {
+		true, true, false, false
+	};
+	struct v4l2_vp9_segmentation *seg = &frame->seg;
+	unsigned int i, j;
+	int value;
+
+	memset(seg->tree_probs, 255, sizeof(seg->tree_probs));
+	memset(seg->pred_probs, 255, sizeof(seg->pred_probs));
+
+	if (!vp9_read_bit(reader))
+		goto complete;
+
+	seg->flags |= V4L2_VP9_SEGMENTATION_FLAG_ENABLED;
+
+	if (vp9_read_bit(reader)) {
+		seg->flags |= V4L2_VP9_SEGMENTATION_FLAG_UPDATE_MAP;
+
+		for (i = 0; i < 7; i++)
+			if (vp9_read_bit(reader))
+				seg->tree_probs[i] = vp9_read_bits(reader, 8);
+
+		if (vp9_read_bit(reader)) {
+			seg->flags |=
+				V4L2_VP9_SEGMENTATION_FLAG_TEMPORAL_UPDATE;
+
+			for (i = 0; i < 3; i++)
+				if (vp9_read_bit(reader))
+					seg->pred_probs[i] =
+						vp9_read_bits(reader, 8);
+		}
+	}
+
+	if (vp9_read_bit(reader)) {
+		seg->flags |= V4L2_VP9_SEGMENTATION_FLAG_UPDATE_DATA;
+		state->seg_abs_or_delta_update = vp9_read_bit(reader);
+
+		for (i = 0; i < 8; i++) {
+			state->seg_feature_enabled[i] = 0;
+
+			for (j = 0; j < V4L2_VP9_SEG_LVL_MAX; j++) {
+				value = 0;
+
+				if (vp9_read_bit(reader)) {
+					state->seg_feature_enabled[i] |=
+						V4L2_VP9_SEGMENT_FEATURE_ENABLED(j);
+
+					value = vp9_read_bits(reader,
+							      feature_bits[j]);
+					if (feature_signed[j] &&
+					    vp9_read_bit(reader))
+						value = -value;
+				}
+
+				state->seg_feature_data[i][j] = value;
+			}
+		}
+	}
+
+complete:
+	if (state->seg_abs_or_delta_update)
+		seg->flags |= V4L2_VP9_SEGMENTATION_FLAG_ABS_OR_DELTA_UPDATE;
+
+	memcpy(seg->feature_data, state->seg_feature_data,
+	       sizeof(seg->feature_data));
+	memcpy(seg->feature_enabled, state->seg_feature_enabled,
+	       sizeof(seg->feature_enabled));
+}
+
+static void vp9_parse_tile_info(struct vp9_bit_reader *reader,
+				struct v4l2_ctrl_vp9_frame *frame)
+{
+	unsigned int mi_cols = (frame->frame_width_minus_1 + 1 + 7) >> 3;
+	unsigned int sb64_cols = (mi_cols + 7) >> 3;
+	unsigned int min_log2 = 0;
+	unsigned int max_log2 = 1;
+
+	while ((64U << min_log2) < sb64_cols)
+		min_log2++;
+
+	while ((sb64_cols >> max_log2) >= 4)
+		max_log2++;
+	max_log2--;
+
+	frame->tile_cols_log2 = min_log2;
+	while (frame->tile_cols_log2 < max_log2 && vp9_read_bit(reader))
+		frame->tile_cols_log2++;
+
+	frame->tile_rows_log2 = vp9_read_bit(reader);
+	if (frame->tile_rows_log2)
+		frame->tile_rows_log2 += vp9_read_bit(reader);
+}
+
+static int vp9_parse_uncompressed_header(struct vp9_bit_reader *reader,
+					 struct vp9_header_state *state,
+					 VADecPictureParameterBufferVP9 *picture,
+					 struct v4l2_ctrl_vp9_frame *frame,
+					 unsigned int *ref_frame_idx)
+{
+	static const unsigned int interpolation_filters[4] = {
+		V4L2_VP9_INTERP_FILTER_EIGHTTAP_SMOOTH,
+		V4L2_VP9_INTERP_FILTER_EIGHTTAP,
+		V4L2_VP9_INTERP_FILTER_EIGHTTAP_SHARP,
+		V4L2_VP9_INTERP_FILTER_BILINEAR,
+	};
+	unsigned int reset_frame_context = 0;
+	bool intra_only = false;
+	bool found_ref = false;
+	bool key_frame;
+	unsigned int i;
+	int rc;
+
+	if (vp9_read_bits(reader, 2) != 2) {
+		request_log("Invalid VP9 frame marker\n");
+		return -1;
+	}
+
+	frame->profile = vp9_read_bit(reader);
+	frame->profile |= vp9_read_bit(reader) << 1;
+	if (frame->profile == 3)
+		vp9_read_bit(reader);
+
+	if (vp9_read_bit(reader)) {
+		request_log("Unexpected VP9 frame with show_existing_frame\n");
+		return -1;
+	}
+
+	key_frame = vp9_read_bit(reader) == 0;
+	if (key_frame)
+		frame->flags |= V4L2_VP9_FRAME_FLAG_KEY_FRAME;
+	if (vp9_read_bit(reader))
+		frame->flags |= V4L2_VP9_FRAME_FLAG_SHOW_FRAME;
+	if (vp9_read_bit(reader))
+		frame->flags |= V4L2_VP9_FRAME_FLAG_ERROR_RESILIENT;
+
+	if (key_frame) {
+		if (vp9_read_bits(reader, 24) != VP9_FRAME_SYNC_CODE)
+			goto error_sync;
+
+		rc = vp9_parse_color_config(reader, frame);
+		if (rc < 0)
+			return -1;
+
+		vp9_parse_frame_size(reader, frame);
+		vp9_parse_render_size(reader, frame);
+	} else {
+		if (!(frame->flags & V4L2_VP9_FRAME_FLAG_SHOW_FRAME))
+			intra_only = vp9_read_bit(reader);
+
+		if (!(frame->flags & V4L2_VP9_FRAME_FLAG_ERROR_RESILIENT))
+			reset_frame_context = vp9_read_bits(reader, 2);
+
+		if (intra_only) {
+			frame->flags |= V4L2_VP9_FRAME_FLAG_INTRA_ONLY;
+
+			if (vp9_read_bits(reader, 24) != VP9_FRAME_SYNC_CODE)
+				goto error_sync;
+
+			if (frame->profile > 0) {
+				rc = vp9_parse_color_config(reader, frame);
+				if (rc < 0)
+					return -1;
+			}
+
+			/* refresh_frame_flags */
+			vp9_read_bits(reader, 8);
+
+			vp9_parse_frame_size(reader, frame);
+			vp9_parse_render_size(reader, frame);
+		} else {
+			/* refresh_frame_flags */
+			vp9_read_bits(reader, 8);
+
+			for (i = 0; i < 3; i++) {
+				ref_frame_idx[i] = vp9_read_bits(reader, 3);
+				if (vp9_read_bit(reader))
+					frame->ref_frame_sign_bias |= 1 << i;
+			}
+
+			for (i = 0; i < 3 && !found_ref; i++)
+				found_ref = vp9_read_bit(reader);
+
+			/* Sizes taken from a reference are given by VA. */
+			if (found_ref) {
+				frame->frame_width_minus_1 =
+					picture->frame_width - 1;
+				frame->frame_height_minus_1 =
+					picture->frame_height - 1;
+			} else {
+				vp9_parse_frame_size(reader, frame);
+			}
+
+			vp9_parse_render_size(reader, frame);
+
+			if (vp9_read_bit(reader))
+				frame->flags |=
+					V4L2_VP9_FRAME_FLAG_ALLOW_HIGH_PREC_MV;
+
+			if (vp9_read_bit(reader))
+				frame->interpolation_filter =
+					V4L2_VP9_INTERP_FILTER_SWITCHABLE;
+			else
+				frame->interpolation_filter =
+					interpolation_filters[vp9_read_bits(reader, 2)];
+		}
+	}
+
+	if (!(frame->flags & V4L2_VP9_FRAME_FLAG_ERROR_RESILIENT)) {
+		if (vp9_read_bit(reader))
+			frame->flags |= V4L2_VP9_FRAME_FLAG_REFRESH_FRAME_CTX;
+		if (vp9_read_bit(reader))
+			frame->flags |= V4L2_VP9_FRAME_FLAG_PARALLEL_DEC_MODE;
+	} else {
+		frame->flags |= V4L2_VP9_FRAME_FLAG_PARALLEL_DEC_MODE;
+	}
+
+	frame->frame_context_idx = vp9_read_bits(reader, 2);
+
+	/* Syntax values 0 and 1 both mean no reset. */
+	if (reset_frame_context == 2)
+		frame->reset_frame_context = V4L2_VP9_RESET_FRAME_CTX_SPEC;
+	else if (reset_frame_context == 3)
+		frame->reset_frame_context = V4L2_VP9_RESET_FRAME_CTX_ALL;
+	else
+		frame->reset_frame_context = V4L2_VP9_RESET_FRAME_CTX_NONE;
+
+	if (key_frame || intra_only ||
+	    (frame->flags & V4L2_VP9_FRAME_FLAG_ERROR_RESILIENT))
+		vp9_setup_past_independence(state);
+
+	vp9_parse_loop_filter(reader, state, frame);
+	vp9_parse_quantization(reader, frame);
+	vp9_parse_segmentation(reader, state, frame);
+	vp9_parse_tile_info(reader, frame);
+
+	frame->compressed_header_size = vp9_read_bits(reader, 16);
+
+	if (vp9_read_overrun(reader)) {
+		request_log("Truncated VP9 uncompressed header\n");
+		return -1;
+	}
+
+	frame->uncompressed_header_size = (reader->offset + 7) / 8;
+
+	return 0;
+
+error_sync:
+	request_log("Invalid VP9 frame sync code\n");
+	return -1;
+}
+
+static unsigned int vp9_decode_term_subexp(struct vp9_bool_decoder *decoder)
+{
+	unsigned int value;
+
+	if (!vp9_read_literal(decoder, 1))
+		return vp9_read_literal(decoder, 4);
+
+	if (!vp9_read_literal(decoder, 1))
+		return vp9_read_literal(decoder, 4) + 16;
+
+	if (!vp9_read_literal(decoder, 1))
+		return vp9_read_literal(decoder, 5) + 32;
+
+	value = vp9_read_literal(decoder, 7);
+	if (value < 65)
+		return value + 64;
+
+	return (value << 1) - 1 + vp9_read_literal(decoder, 1);
+}
+
+/*
+ * Probability updates are passed as coded deltas (0 when not updated) and
+ * applied by the driver, which owns the frame probability contexts.
+ */
+static void vp9_diff_update_probs(struct vp9_bool_decoder *decoder,
+				  uint8_t *deltas, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		deltas[i] = vp9_read_bool(decoder, 252) ?
+				    vp9_decode_term_subexp(decoder) : 0;
+}
+
+static void vp9_update_mv_probs(struct vp9_bool_decoder *decoder,
+				uint8_t *probs, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		probs[i] = vp9_read_bool(decoder, 252) ?
+				   vp9_read_literal(decoder, 7) << 1 | 1 : 0;
+}
+
+static void vp9_parse_coef_probs(struct vp9_bool_decoder *decoder,
+				 struct v4l2_ctrl_vp9_compressed_hdr *header)
+{
+	static const unsigned int biggest_tx_sizes[] = { 0, 1, 2, 3, 3 };
+	unsigned int tx_size, i, j, k;
+
+	for (tx_size = 0; tx_size <= biggest_tx_sizes[header->tx_mode];
+	     tx_size++) {
+		if (!vp9_read_literal(decoder, 1))
+			continue;
+
+		for (i = 0; i < 2; i++)
+			for (j = 0; j < 2; j++)
+				for (k = 0; k < 6; k++)
+					vp9_diff_update_probs(decoder,
+						header->coef[tx_size][i][j][k][0],
+						(k == 0 ? 3 : 6) * 3);
+	}
+}
+
+static void vp9_parse_reference_mode(struct vp9_bool_decoder *decoder,
+				     struct v4l2_ctrl_vp9_frame *frame,
+				     struct v4l2_ctrl_vp9_compressed_hdr *header)
+{
+	unsigned int sign_bias = frame->ref_frame_sign_bias;
+	bool last_bias = sign_bias & V4L2_VP9_SIGN_BIAS_LAST;
+	bool golden_bias = sign_bias & V4L2_VP9_SIGN_BIAS_GOLDEN;
+	bool alt_bias = sign_bias & V4L2_VP9_SIGN_BIAS_ALT;
+	unsigned int i;
+
+	frame->reference_mode = V4L2_VP9_REFERENCE_MODE_SINGLE_REFERENCE;
+
+	if (golden_bias != last_bias || alt_bias != last_bias) {
+		if (vp9_read_literal(decoder, 1))
+			frame->reference_mode = vp9_read_literal(decoder, 1) ?
+				V4L2_VP9_REFERENCE_MODE_SELECT :
+				V4L2_VP9_REFERENCE_MODE_COMPOUND_REFERENCE;
+	}
+
+	if (frame->reference_mode == V4L2_VP9_REFERENCE_MODE_SELECT)
+		vp9_diff_update_probs(decoder, header->comp_mode, 5);
+
+	if (frame->reference_mode !=
+	    V4L2_VP9_REFERENCE_MODE_COMPOUND_REFERENCE)
+		for (i = 0; i < 5; i++)
+			vp9_diff_update_probs(decoder, header->single_ref[i],
+					      2);
+
+	if (frame->reference_mode != V4L2_VP9_REFERENCE_MODE_SINGLE_REFERENCE)
+		vp9_diff_update_probs(decoder, header->comp_ref, 5);
+}
+
+static void vp9_parse_mv_probs(struct vp9_bool_decoder *decoder,
+			       struct v4l2_ctrl_vp9_frame *frame,
+			       struct v4l2_vp9_mv_probs *mv)
+{
+	unsigned int i;
+
+	vp9_update_mv_probs(decoder, mv->joint, 3);
+
+	for (i = 0; i < 2; i++) {
+		vp9_update_mv_probs(decoder, &mv->sign[i], 1);
+		vp9_update_mv_probs(decoder, mv->classes[i], 10);
+		vp9_update_mv_probs(decoder, &mv->class0_bit[i], 1);
+		vp9_update_mv_probs(decoder, mv->bits[i], 10);
+	}
+
+	for (i = 0; i < 2; i++) {
+		vp9_update_mv_probs(decoder, mv->class0_fr[i][0], 6);
+		vp9_update_mv_probs(decoder, mv->fr[i], 3);
+	}
+
+	if (frame->flags & V4L2_VP9_FRAME_FLAG_ALLOW_HIGH_PREC_MV) {
+		for (i = 0; i < 2; i++) {
+			vp9_update_mv_probs(decoder, &mv->class0_hp[i], 1);
+			vp9_update_mv_probs(decoder, &mv->hp[i], 1);
+		}
+	}
+}
+
+static int vp9_parse_compressed_header(struct vp9_bool_decoder *decoder,
+				       struct v4l2_ctrl_vp9_frame *frame,
+				       struct v4l2_ctrl_vp9_compressed_hdr *header)
+{
+	bool lossless;
+
+	lossless = frame->quant.base_q_idx == 0 &&
+		   frame->quant.delta_q_y_dc == 0 &&
+		   frame->quant.delta_q_uv_dc == 0 &&
+		   frame->quant.delta_q_uv_ac == 0;
+
+	if (lossless) {
+		header->tx_mode = V4L2_VP9_TX_MODE_ONLY_4X4;
+	} else {
+		header->tx_mode = vp9_read_literal(decoder, 2);
+		if (header->tx_mode == V4L2_VP9_TX_MODE_ALLOW_32X32)
+			header->tx_mode += vp9_read_literal(decoder, 1);
+	}
+
+	if (header->tx_mode == V4L2_VP9_TX_MODE_SELECT) {
+		vp9_diff_update_probs(decoder, header->tx8[0], 2 * 1);
+		vp9_diff_update_probs(decoder, header->tx16[0], 2 * 2);
+		vp9_diff_update_probs(decoder, header->tx32[0], 2 * 3);
+	}
+
+	vp9_parse_coef_probs(decoder, header);
+	vp9_diff_update_probs(decoder, header->skip, 3);
+
+	if (!(frame->flags & (V4L2_VP9_FRAME_FLAG_KEY_FRAME |
+			      V4L2_VP9_FRAME_FLAG_INTRA_ONLY))) {
+		vp9_diff_update_probs(decoder, header->inter_mode[0], 7 * 3);
+
+		if (frame->interpolation_filter ==
+		    V4L2_VP9_INTERP_FILTER_SWITCHABLE)
+			vp9_diff_update_probs(decoder,
+					      header->interp_filter[0], 4 * 2);
+
+		vp9_diff_update_probs(decoder, header->is_inter, 4);
+		vp9_parse_reference_mode(decoder, frame, header);
+		vp9_diff_update_probs(decoder, header->y_mode[0], 4 * 9);
+		vp9_diff_update_probs(decoder, header->partition[0], 16 * 3);
+		vp9_parse_mv_probs(decoder, frame, &header->mv);
+	}
+
+	if (vp9_read_overrun(&decoder->reader)) {
+		request_log("Truncated VP9 compressed header\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint64_t vp9_reference_timestamp(struct request_data *driver_data,
+					VASurfaceID surface_id)
+{
+	struct object_surface *surface_object;
+
+	surface_object = SURFACE(driver_data, surface_id);
+	if (surface_object == NULL)
+		return 0;
+
+	return v4l2_timeval_to_ns(&surface_object->timestamp);
+}
+
+int vp9_set_controls(struct request_data *driver_data,
+		     struct object_context *context_object,
+		     struct object_surface *surface_object)
+{
+	VADecPictureParameterBufferVP9 *picture =
+		&surface_object->params->vp9.picture;
+	struct v4l2_ctrl_vp9_compressed_hdr header;
+	struct v4l2_ctrl_vp9_frame frame;
+	struct vp9_bit_reader reader;
+	struct vp9_bool_decoder decoder;
+	unsigned int ref_frame_idx[3] = { 0 };
+	unsigned char *data = surface_object->source_data;
+	unsigned int size = surface_object->slices_size;
+	int rc;
+
+	memset(&frame, 0, sizeof(frame));
+	memset(&header, 0, sizeof(header));
+
+	reader.data = data;
+	reader.size = size;
+	reader.offset = 0;
+
+	rc = vp9_parse_uncompressed_header(&reader, &context_object->vp9,
+					   picture, &frame, ref_frame_idx);
+	if (rc < 0)
+		return -1;
+
+	if (frame.uncompressed_header_size + frame.compressed_header_size >
+	    size) {
+		request_log("Truncated VP9 frame\n");
+		return -1;
+	}
+
+	rc = vp9_bool_init(&decoder, data + frame.uncompressed_header_size,
+			   frame.compressed_header_size);
+	if (rc < 0) {
+		request_log("Invalid VP9 compressed header marker\n");
+		return -1;
+	}
+
+	rc = vp9_parse_compressed_header(&decoder, &frame, &header);
+	if (rc < 0)
+		return -1;
+
+	/* Only 4:2:0 profiles are exposed. */
+	frame.flags |= V4L2_VP9_FRAME_FLAG_X_SUBSAMPLING |
+		       V4L2_VP9_FRAME_FLAG_Y_SUBSAMPLING;
+	frame.bit_depth = picture->bit_depth;
+
+	/* VA provides the reference slot table for the frame. */
+	if (!(frame.flags & (V4L2_VP9_FRAME_FLAG_KEY_FRAME |
+			     V4L2_VP9_FRAME_FLAG_INTRA_ONLY))) {
+		frame.last_frame_ts = vp9_reference_timestamp(driver_data,
+			picture->reference_frames[ref_frame_idx[0]]);
+		frame.golden_frame_ts = vp9_reference_timestamp(driver_data,
+			picture->reference_frames[ref_frame_idx[1]]);
+		frame.alt_frame_ts = vp9_reference_timestamp(driver_data,
+			picture->reference_frames[ref_frame_idx[2]]);
+	}
+
+	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
+			      V4L2_CID_STATELESS_VP9_FRAME, &frame,
+			      sizeof(frame));
+	if (rc < 0)
+		return -1;
+
+	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
+			      V4L2_CID_STATELESS_VP9_COMPRESSED_HDR, &header,
+			      sizeof(header));
+	if (rc < 0)
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2026 libva-v4l2-request contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _VP9_H_
+#define _VP9_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct object_context;
+struct object_surface;
+struct request_data;
+
+/*
+ * Uncompressed header values that persist from one frame to the next unless
+ * explicitly updated, kept per context. Frame probability contexts are kept
+ * by the kernel driver and only the compressed header deltas are passed.
+ */
+struct vp9_header_state {
+	int8_t lf_ref_deltas[4];
+	int8_t lf_mode_deltas[2];
+	int16_t seg_feature_data[8][4];
+	uint8_t seg_feature_enabled[8];
+	bool seg_abs_or_delta_update;
+};
+
+int vp9_set_controls(struct request_data *driver_data,
+		     struct object_context *context,
+		     struct object_surface *surface_object);
+
+#endif